@@ -73,20 +73,87 @@ define_system_module tb ../tb/system.cpp ../tb/sc_main.cpp
 ######################################################################
 set DEFAULT_ARGV ""
 
-foreach dma [list 32 64] {
-    define_io_config * IOCFG_DMA$dma -DDMA_WIDTH=$dma
+# Testbench cases: layers that the default parameters of system.hpp do not
+# cover, run as name=value arguments on the default variant of each width.
+# The defaults pool and post-process, _PLAIN is a bare convolution
+set TB_CASES [list \
+		  "_PW_CHUNKS" "P=28 Q=28 R=1 S=1 C=62 M=4 N=1" \
+		  "_PLAIN" "P=12 Q=12 R=3 S=3 C=4 M=4 N=1 pool=1 pool_stride=1 post=0 relu=0" \
+		  "_SATURATE" "P=8 Q=8 R=3 S=3 C=8 M=4 N=1 pool=1 pool_stride=1 post=0 relu=0 data_range=100000" \
+		  "_STRIDE2" "P=14 Q=14 H=28 W=28 R=3 S=3 stride=2 pad=1 C=4 M=4 N=1 pool=1 pool_stride=1" \
+		  "_DILATION" "P=10 Q=10 R=3 S=3 dilation=2 C=4 M=4 N=1" \
+		  "_GROUPS" "P=12 Q=12 R=3 S=3 C=8 M=8 N=1 groups=2" \
+		  "_WINOGRAD" "P=12 Q=12 R=3 S=3 pad=1 C=4 M=4 N=1 pool=1 pool_stride=1 winograd=1" \
+		  "_SPARSE" "P=12 Q=12 R=3 S=3 pad=1 C=8 M=4 N=1 sparse=1" \
+		  "_STREAM" "P=28 Q=28 R=3 S=3 pad=1 C=8 M=4 N=1 stream=1" \
+		  "_BLOCK_ROWS" "P=28 Q=28 R=3 S=3 pad=1 C=8 M=4 N=1 block_rows=2" \
+		  "_COALESCE" "P=12 Q=12 R=3 S=3 C=4 M=8 N=2 coalesce=1"]
+
+# Every configuration costs an HLS run: by default only the original DMA32
+# and DMA64 ones, the narrow data types and each variant at DMA64 are
+# defined. Set CONV_SWEEP=1 in the environment for all of them.
+set SWEEP [expr {[info exists ::env(CONV_SWEEP)] && $::env(CONV_SWEEP) eq "1"}]
+if {$SWEEP} {
+    set DMA_WIDTHS [list 32 64 128 256]
+} else {
+    set DMA_WIDTHS [list 32 64]
+}
+
+foreach dma $DMA_WIDTHS {
+    # Element width of activations and weights, 32 keeps the original names
+    foreach data [list 32 16 8] {
+	if {$data == 32} {
+	    set dname ""
+	} else {
+	    set dname "_INT$data"
+	}
 
-    define_system_config tb TESTBENCH_DMA$dma -io_config IOCFG_DMA$dma
+	# Variants: the default keeps the original names, _WB3 and _WB4 deepen the
+	# weight queue, _R3S3 and _R1S1 specialize the 3x3 and 1x1 kernels,
+	# _SMALL and _LARGE resize the PLMs (see memlist.txt), _SUM32 accumulates
+	# in 32 bits without saturation, _FP32 computes in single precision
+	set variants [list "" "" \
+			   "_WB3" "-DWEIGHT_BUFFERS=3" \
+			   "_WB4" "-DWEIGHT_BUFFERS=4" \
+			   "_R3S3" "-DCONV_R=3 -DCONV_S=3" \
+			   "_R1S1" "-DCONV_R=1 -DCONV_S=1" \
+			   "_SMALL" "-DPLM_PROFILE=0" \
+			   "_LARGE" "-DPLM_PROFILE=2" \
+			   "_SUM32" "-DSUM_WIDTH=32"]
+	if {$data == 32} {
+	    lappend variants "_FP32" "-DDATA_FP32"
+	}
 
-    define_sim_config "BEHAV_DMA$dma" "conv BEH" "tb TESTBENCH_DMA$dma" -io_config IOCFG_DMA$dma -argv $DEFAULT_ARGV
+	foreach {vname vflags} $variants {
+	    if {!($SWEEP || ($data == 32 && $vname eq "") || ($dma == 64 && ($data == 32 || $vname eq "")))} {
+		continue
+	    }
 
-    foreach cfg [list BASIC] {
-	set cname $cfg\_DMA$dma
-	define_hls_config conv $cname -io_config IOCFG_DMA$dma --clock_period=$CLOCK_PERIOD $COMMON_HLS_FLAGS -DHLS_DIRECTIVES_$cfg
-	if {$TECH_IS_XILINX == 1} {
-	    define_sim_config "$cname\_V" "conv RTL_V $cname" "tb TESTBENCH_DMA$dma" -io_config IOCFG_DMA$dma -argv $DEFAULT_ARGV -verilog_top_modules glbl
-	} else {
-	    define_sim_config "$cname\_V" "conv RTL_V $cname" "tb TESTBENCH_DMA$dma" -io_config IOCFG_DMA$dma -argv $DEFAULT_ARGV
+	    set vcfg $dname\_DMA$dma$vname
+
+	    define_io_config * IOCFG$vcfg -DDMA_WIDTH=$dma -DDATA_WIDTH=$data {*}$vflags
+
+	    define_system_config tb TESTBENCH$vcfg -io_config IOCFG$vcfg
+
+	    define_sim_config "BEHAV$vcfg" "conv BEH" "tb TESTBENCH$vcfg" -io_config IOCFG$vcfg -argv $DEFAULT_ARGV
+
+	    # Qm.n case: values in [-1, 1) with half of the data bits as fraction
+	    if {$vname eq ""} {
+		set cases [concat $TB_CASES [list "_QMN" "P=12 Q=12 R=3 S=3 C=4 M=4 N=1 pool=1 pool_stride=1 post=0 relu=0 frac_bits=[expr {$data / 2}]"]]
+		foreach {tname targv} $cases {
+		    define_sim_config "BEHAV$vcfg$tname" "conv BEH" "tb TESTBENCH$vcfg" -io_config IOCFG$vcfg -argv $targv
+		}
+	    }
+
+	    foreach cfg [list BASIC] {
+		set cname $cfg$vcfg
+		define_hls_config conv $cname -io_config IOCFG$vcfg --clock_period=$CLOCK_PERIOD $COMMON_HLS_FLAGS -DHLS_DIRECTIVES_$cfg
+		if {$TECH_IS_XILINX == 1} {
+		    define_sim_config "$cname\_V" "conv RTL_V $cname" "tb TESTBENCH$vcfg" -io_config IOCFG$vcfg -argv $DEFAULT_ARGV -verilog_top_modules glbl
+		} else {
+		    define_sim_config "$cname\_V" "conv RTL_V $cname" "tb TESTBENCH$vcfg" -io_config IOCFG$vcfg -argv $DEFAULT_ARGV
+		}
+	    }
 	}
     }
 }
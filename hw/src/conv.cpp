@@ -9,65 +9,78 @@
 #include "conv_functions.hpp"
 
 void conv::load_counter(){
-    int load_index;
     {
         HLS_PROTO("load-counter-reset");
-        load_index = 0;
+        for (int m = 0 ; m < COUNTERS_MAX ; m++)
+            weight_load_time[m] = 0;
         wait();
     }
     while(1){
-        //cout << "Current load index: " << load_index << endl;
-        while(!load_start){
+        // Bands of the same filter accumulate into one entry, a load shared
+        // by load_filters filters counts for every one of them
+        while(!load_start.read()){
             wait();
-            weight_load_time[load_index] = 0;
         }
-        while(load_start){
+        while(load_start.read()){
             wait();
-            weight_load_time[load_index]++;
+            uint32_t filter = load_filter.read();
+            uint32_t filters = load_filters.read();
+            for (int f = 0 ; f < FILTERS_MAX ; f++){
+                HLS_UNROLL_SIMPLE;
+                if (f < filters)
+                    weight_load_time[filter + f]++;
+            }
         }
-        load_index++;
     }
 }
 
-void conv::compute_counter(){   
-    int compute_index = 0;
+void conv::compute_counter(){
     {
         HLS_PROTO("computes-counter-reset");
-        compute_index = 0;
+        for (int m = 0 ; m < COUNTERS_MAX ; m++) {
+            kernel_compute_time[m] = 0;
+            compute_stall_time[m] = 0;
+        }
         wait();
     }
     while(1){
-        //cout << "Current compute index: " << compute_index << endl;
-        while(!compute_start){
+        while(!compute_start.read() && !compute_stall.read()){
             wait();
-            kernel_compute_time[compute_index] = 0;
         }
-        while(compute_start){
+        // A pass computes (or stalls) for every one of its filters
+        while(compute_start.read() || compute_stall.read()){
             wait();
-            kernel_compute_time[compute_index]++;
+            uint32_t filter = compute_filter.read();
+            uint32_t filters = compute_filters.read();
+            bool stall = compute_stall.read();
+            for (int f = 0 ; f < FILTERS_MAX ; f++){
+                HLS_UNROLL_SIMPLE;
+                if (f < filters) {
+                    if (stall)
+                        compute_stall_time[filter + f]++;
+                    else
+                        kernel_compute_time[filter + f]++;
+                }
+            }
         }
-        compute_index++;
     }
 }
 
 void conv::store_counter(){
-    int store_index = 0;
     {
         HLS_PROTO("store-counter-reset");
-        store_index = 0;
+        for (int m = 0 ; m < COUNTERS_MAX ; m++)
+            result_write_time[m] = 0;
         wait();
     }
     while(1){
-        //cout << "Current store index: " << store_index << endl;
-        while(!store_start){
+        while(!store_start.read()){
             wait();
-            result_write_time[store_index] = 0;
         }
-        while(store_start){
+        while(store_start.read()){
             wait();
-            result_write_time[store_index]++;
+            result_write_time[store_filter.read()]++;
         }
-        store_index++;
     }
 }
 // Processes
@@ -76,25 +89,27 @@ void conv::clock_cycle_counter(){
     {
         HLS_PROTO("cycle-counter-reset");
 
-        cycle_counter = 0;
-        cycle_counter_overflow = false;
+        cycle_counter.write(0);
+        cycle_counter_overflow.write(false);
         
 
         wait();
     }
     {
         HLS_PROTO("cycle-counter-waiting");
-        while(!acc_start){
+        while(!acc_start.read()){
             wait();
         }
     }
     {
         HLS_PROTO("cycle-counter-waiting");    
-        while(!acc_finish){
+        uint32_t cycles = 0;
+        while(!acc_finish.read()){
             wait();
-            cycle_counter++;
-            if(cycle_counter >= UINT32_MAX)
-                cycle_counter_overflow = true;   
+            cycles++;
+            cycle_counter.write(cycles);
+            if(cycles == UINT32_MAX)
+                cycle_counter_overflow.write(true);   
         }
     }
 }
@@ -110,12 +125,36 @@ void conv::load_input()
         // explicit PLM ports reset if any
 
         // User-defined reset code
+        load_steps.write(0);
+        load_filters.write(0);
+        load_filter.write(0);
+        load_start.write(false);
+        acc_start.write(false);
 
         wait();
     }
 
     // Config
     /* <<--params-->> */
+    int32_t W;
+    int32_t H;
+    int32_t frac_bits;
+    int32_t coalesce;
+    int32_t block_rows;
+    int32_t stream;
+    int32_t sparse;
+    int32_t winograd;
+    int32_t groups;
+    int32_t pool_avg;
+    int32_t pool_stride;
+    int32_t pool;
+    int32_t relu;
+    int32_t post;
+    int32_t pad;
+    int32_t dilation;
+    int32_t stride;
+    int32_t N;
+    int32_t K;
     int32_t mem_output_addr;
     int32_t mem_input_addr;
     int32_t S;
@@ -124,14 +163,39 @@ void conv::load_input()
     int32_t P;
     int32_t M;
     int32_t C;
+    conf_info_t config;
+    bool specialized;
     {
         HLS_PROTO("load-config");
 
         cfg.wait_for_config(); // config process
-        conf_info_t config = this->conf_info.read();
+        config = this->conf_info.read();
+        specialized = specialize(config);
+
+        // Wide beats may need narrower filter passes to align the output bands
+        config.K = pass_filters(config);
 
         // User-defined config code
         /* <<--local-params-->> */
+        W = config.W;
+        H = config.H;
+        frac_bits = config.frac_bits;
+        coalesce = config.coalesce;
+        block_rows = config.block_rows;
+        stream = config.stream;
+        sparse = config.sparse;
+        winograd = config.winograd;
+        groups = config.groups;
+        pool_avg = config.pool_avg;
+        pool_stride = config.pool_stride;
+        pool = config.pool;
+        relu = config.relu;
+        post = config.post;
+        pad = config.pad;
+        dilation = config.dilation;
+        stride = config.stride;
+        N = config.N;
+        K = config.K;
         mem_output_addr = config.mem_output_addr;
         mem_input_addr = config.mem_input_addr;
         S = config.S;
@@ -140,125 +204,365 @@ void conv::load_input()
         P = config.P;
         M = config.M;
         C = config.C;
-        
-        load_start = false;
     }
-    acc_start = true;
+    acc_start.write(true);
     //printf("Load Start at: %d\n", (int)cycle_counter);
     // Load
     {
         HLS_PROTO("load-dma");
         wait();
 
-        bool ping = true;
+        uint32_t slot = 0;
+        uint32_t steps = 0;
+        uint32_t weight_sets = 0;
+        bool in_ping = false;
+        uint32_t in_loads = 0;
 
         int32_t index = 0;
-        bool need_shift = false;
 
-        
-        uint32_t input_length = round_up(C*(P+R-1)*(Q+S-1), DMA_WORD_PER_BEAT);
-        uint32_t weight_offset = input_length;
-        uint32_t weight_length = round_up(C*R*S, DMA_WORD_PER_BEAT);
+        // Memory holds the input without the pad, plm_in holds the padded rows:
+        // the pad, then the first mem_cols columns, then zeros up to in_width
+        int32_t in_width = in_span(Q, S, stride, dilation);
+        int32_t mem_height = in_extent(H, P, R, stride, dilation, pad);
+        int32_t mem_width = in_extent(W, Q, S, stride, dilation, pad);
+        int32_t mem_cols = (mem_width < in_width - pad) ? mem_width : in_width - pad;
+        uint32_t mem_pitch = round_up(mem_width, DMA_WORD_PER_BEAT);
+        uint32_t pitch = in_pitch(in_width);
+        uint32_t taps = kernel_words(config);
+        bool pw = pointwise_mode(config);
+        uint32_t weight_base = N*C*mem_height*mem_pitch;
+        uint32_t filter_stride = filter_words(config);
+        uint32_t post_base = weight_base + M*filter_stride;
+        uint32_t nz_offset[FILTERS_MAX];
+        int32_t out_height = pooled(P, pool, pool_stride);
+        int32_t Cg = C / groups;
+        int32_t Mg = M / groups;
+        int32_t chunk = chunk_channels(config);
+        int32_t rows = band_rows(config, chunk);
+        int32_t band = specialized ? first_band(config, rows) : 0;
+        bool resident = weights_resident(config, chunk);
+
+        // Row bands: output rows [pp0, pp0 + band) pool conv rows from p0, which
+        // need in_rows input rows from p0 * stride
+        for (int pp0 = 0; band > 0 && pp0 < out_height; pp0 += band, band = next_band(band, rows))
+        {
+            // Resident weight sets are in buffers [0, passes) for every band
+            if (resident)
+                slot = 0;
+
+            int32_t p0 = pp0*pool_stride;
+            int32_t conv_rows = in_span((pp0 + band > out_height) ? out_height - pp0 : band, pool, pool_stride, 1);
+            int32_t in_rows = in_span(conv_rows, R, stride, dilation);
+            uint32_t slots = in_slots(in_rows, dilation);
+            uint32_t phase_rows = slots / dilation;
+
+            // Band rows [top, bottom) are in memory from row y0 + top, the others are pad
+            int32_t y0 = p0*stride - pad;
+            int32_t top = (y0 < 0) ? -y0 : 0;
+            int32_t bottom = (mem_height - y0 < in_rows) ? mem_height - y0 : in_rows;
+            if (top > in_rows)
+                top = in_rows;
+            if (bottom < top)
+                bottom = top;
+
+            // Filter passes: up to K filters of one conv group share every pass over
+            // plm_in, which holds channels [cb + c0, cb + c0 + chunk) of the group
+            int32_t filters = 0;
+            for (int m0 = 0; m0 < M; m0 += filters)
+            {
+                int32_t group_end = (m0 / Mg + 1) * Mg;
+                int32_t cb = (m0 / Mg) * Cg;
+                filters = (m0 + K > group_end) ? group_end - m0 : K;
 
-        // load whole image
-        dma_info_t dma_info(0, input_length / DMA_WORD_PER_BEAT, DMA_SIZE);
-        sc_dt::sc_bv<DMA_WIDTH> dataBv;
-        this->dma_read_ctrl.put(dma_info);
+                // Images of the batch
+                for (int n = 0; n < N; n++)
+                {
+                    // Channel chunks: channels [c0, c0 + chunk) of the conv group
+                    for (int c0 = 0; c0 < Cg; c0 += chunk)
+                    {
+                        uint32_t channels = (c0 + chunk > Cg) ? Cg - c0 : chunk;
+
+                        // The pass weights stay resident across the batch unless Cg is chunked,
+                        // and across the bands when they are resident. They go to the next
+                        // free buffer of the queue
+                        if ((n == 0 || chunk < Cg) && (pp0 == 0 || !resident))
+                        {
+                            this->load_weight_wait(weight_sets);
+
+                            // Weights of filter m0 + f go to plm_weight[w * K + f]
+                            for (int f = 0; f < filters; f++)
+                            {
+                                load_filter.write(m0 + f);
+                                load_filters.write(1);
+                                load_start.write(true);
+                                index = f;
+
+                                // Sparse filters: the nonzero counts of the chunk channels, then
+                                // their (tap, value) entries, which follow those of the previous chunks
+                                uint32_t nnz = 0;
+                                if (c0 == 0)
+                                    nz_offset[f] = 0;
+
+                                for (int part = 0; part < (sparse ? 2 : 1); part++)
+                                {
+                                    uint32_t offset = weight_base + (m0 + f)*filter_stride + c0*taps;
+                                    uint32_t length = channels*taps;
+                                    if (sparse && part == 0) {
+                                        offset = weight_base + (m0 + f)*filter_stride + c0;
+                                        length = channels;
+                                    } else if (sparse) {
+                                        offset = weight_base + (m0 + f)*filter_stride + round_up(Cg, DMA_WORD_PER_BEAT) + nz_offset[f]*2;
+                                        length = nnz*2;
+                                    }
+                                    if (length == 0)
+                                        continue;
 
-        for(int i = 0 ; i < input_length ; i += DMA_WORD_PER_BEAT){
+                                    uint32_t skip = offset % DMA_WORD_PER_BEAT;
+                                    uint32_t burst_words = round_up(skip + length, DMA_WORD_PER_BEAT);
 
-            //printf("Load Input Start at: %d\n", (int)cycle_counter);
-            HLS_BREAK_DEP(plm_in);
+                                    dma_info_t dma_info(offset / DMA_WORD_PER_BEAT, burst_words / DMA_WORD_PER_BEAT, DMA_SIZE);
+                                    this->dma_read_ctrl.put(dma_info);
+                                    wait();
 
+                                    for (uint16_t i = 0; i < burst_words; i += DMA_WORD_PER_BEAT)
+                                    {
+                                        HLS_BREAK_DEP_WEIGHT;
 
-            dataBv = this->dma_read_chnl.get();
-            wait();
+                                        sc_dt::sc_bv<DMA_WIDTH> dataBv;
 
-            // Write to PLM (all DMA_WORD_PER_BEAT words in one cycle)
-            for (uint16_t k = 0; k < DMA_WORD_PER_BEAT; k++) {
-                //HLS_UNROLL_SIMPLE;
-                wait();
-                plm_in[index + k] = dataBv.range((k+1) * DATA_WIDTH - 1, k * DATA_WIDTH).to_int64();
-                //printf("plm_in[%d]:%d\n", index + k, (int)plm_in[index + k]);
-            }
-            index += DMA_WORD_PER_BEAT;
-            
-        }
-        
-        need_shift = (index > C*(P+R-1)*(Q+S-1));
-
-        //printf("Load Input End at: %d\n", (int)cycle_counter);
-
-        // Chunking weight loading
-        for (int m = 0; m < M; m++)
-        {    
-            load_start = true;
-            //printf("Load Weight[%d] Start at: %d\n", m, load_weight_start);
-            if(need_shift == true){
-                dma_info_t dma_info((weight_offset / DMA_WORD_PER_BEAT) - 1, weight_length / DMA_WORD_PER_BEAT, DMA_SIZE);
-                //cout << "Set weight_offset: " << weight_offset << endl;
-                weight_offset += weight_length - 2;
-                this->dma_read_ctrl.put(dma_info);
-            }
-            else {
-                dma_info_t dma_info(weight_offset / DMA_WORD_PER_BEAT, weight_length / DMA_WORD_PER_BEAT, DMA_SIZE);
-                //cout << "Set weight_offset: " << weight_offset << endl;
-                weight_offset += weight_length;
-                this->dma_read_ctrl.put(dma_info);
-            }
-            index = 0;
-            wait();
-            
+                                        dataBv = this->dma_read_chnl.get();
+                                        wait();
 
-            for (uint16_t i = 0; i < weight_length; i += DMA_WORD_PER_BEAT)
-            {
-                HLS_BREAK_DEP(plm_weight_ping);
-                HLS_BREAK_DEP(plm_weight_pong);
+                                        // Write to PLM, dropping the words of a misaligned beat outside the chunk.
+                                        // Words of a beat are K apart, in the same bank: one per cycle
+                                        for (uint16_t k = 0; k < DMA_WORD_PER_BEAT; k++)
+                                        {
+                                            wait();
+                                            if (i + k >= skip && i + k < skip + length) {
+                                                sc_dt::sc_int<DATA_WIDTH> data = dataBv.range((k+1) * DATA_WIDTH - 1, k * DATA_WIDTH).to_int64();
+                                                uint32_t word = index + (i + k - skip)*K;
+                                                this->weight_write(slot, word, data);
+                                                if (sparse && part == 0)
+                                                    nnz += data;
+                                            }
+                                        }
+                                    }
 
-                sc_dt::sc_bv<DMA_WIDTH> dataBv;
+                                    index += length*K;
+                                }
 
-                dataBv = this->dma_read_chnl.get();
-                wait();
+                                nz_offset[f] += nnz;
+                                load_start.write(false);
+                            }
 
-                if(need_shift){
-                    if (ping){
-                        plm_weight_ping[index] = dataBv.range(63,32).to_int64();
-                        //printf("plm_weight[%d]:%d\n", index, (int)plm_weight_ping[index]);
-                    }
-                    else{
-                        plm_weight_pong[index] = dataBv.range(63,32).to_int64();
-                        //printf("plm_weight[%d]:%d\n", index, (int)plm_weight_pong[index]);
-                    }
-                    index++;
-                    need_shift = false;
-                    continue;
-                }
+                            // Bias, multiplier and shift of filter m0 + f follow its last chunk
+                            // weights, at plm_weight[(channels*taps + i) * K + f]
+                            if (post && c0 + chunk >= Cg)
+                            {
+                                load_filter.write(m0);
+                                load_filters.write(filters);
+                                load_start.write(true);
+
+                                uint32_t offset = post_base + m0*POST_PARAMS;
+                                uint32_t length = filters*POST_PARAMS;
+                                uint32_t skip = offset % DMA_WORD_PER_BEAT;
+                                uint32_t burst_words = round_up(skip + length, DMA_WORD_PER_BEAT);
+
+                                dma_info_t dma_info(offset / DMA_WORD_PER_BEAT, burst_words / DMA_WORD_PER_BEAT, DMA_SIZE);
+                                this->dma_read_ctrl.put(dma_info);
+                                uint32_t param = 0;
+                                uint32_t f = 0;
+                                wait();
 
-                // Write to PLM (all DMA_WORD_PER_BEAT words in one cycle)
-                for (uint16_t k = 0; k < DMA_WORD_PER_BEAT; k++)
-                {
-                    //HLS_UNROLL_SIMPLE;
-                    wait();
-                    if (ping){ 
-                        plm_weight_ping[index+k] = dataBv.range((k+1) * DATA_WIDTH - 1, k * DATA_WIDTH).to_int64();
-                        //printf("plm_weight[%d]:%d\n", index, (int)plm_weight_ping[index]);
-                    }
-                    else{
-                        plm_weight_pong[index+k] = dataBv.range((k+1) * DATA_WIDTH - 1, k * DATA_WIDTH).to_int64();
-                        //printf("plm_weight[%d]:%d\n", index, (int)plm_weight_pong[index]);
+                                for (uint16_t i = 0; i < burst_words; i += DMA_WORD_PER_BEAT)
+                                {
+                                    HLS_BREAK_DEP_WEIGHT;
+
+                                    sc_dt::sc_bv<DMA_WIDTH> dataBv;
+
+                                    dataBv = this->dma_read_chnl.get();
+                                    wait();
+
+                                    for (uint16_t k = 0; k < DMA_WORD_PER_BEAT; k++)
+                                    {
+                                        wait();
+                                        if (i + k >= skip && i + k < skip + length) {
+                                            index = (channels*taps + param)*K + f;
+                                            this->weight_write(slot, index, dataBv.range((k+1) * DATA_WIDTH - 1, k * DATA_WIDTH).to_int64());
+                                            param++;
+                                            if (param == POST_PARAMS) {
+                                                param = 0;
+                                                f++;
+                                            }
+                                        }
+                                    }
+                                }
+
+                                load_start.write(false);
+                            }
+                        }
+
+                        // plm_in is refilled for every chunk and image, or once per conv group
+                        // of the band when they all fit. Refills alternate between the ping and
+                        // pong buffers, so the next input streams in while compute reads the current one
+                        if (chunk < Cg || N > 1 || m0 % Mg == 0)
+                        {
+                            // From the third refill on, wait for compute to release the buffer
+                            this->load_input_wait(in_loads);
+                            in_ping = !in_ping;
+                            in_loads++;
+
+                            // A band spanning the whole image is a single burst, otherwise one burst per
+                            // channel; memory rows start on a beat, so every beat fills DMA_WORD_PER_BEAT words
+                            bool single = (bottom - top == mem_height);
+                            uint32_t burst_length = single ? channels*mem_height*mem_pitch : (bottom - top)*mem_pitch;
+
+                            for (int c = 0; c < channels; c++)
+                            {
+                                if ((c == 0 || !single) && bottom > top)
+                                {
+                                    uint32_t offset = (n*C + cb + c0 + c)*mem_height*mem_pitch + (y0 + top)*mem_pitch;
+
+                                    dma_info_t dma_info(offset / DMA_WORD_PER_BEAT, burst_length / DMA_WORD_PER_BEAT, DMA_SIZE);
+                                    this->dma_read_ctrl.put(dma_info);
+                                }
+
+                                // Rows are padded to the bank-friendly pitch in plm_in
+                                // and grouped by phase modulo the dilation; the channels
+                                // of a 1x1 layer are interleaved instead
+                                uint32_t phase = 0;
+                                uint32_t phase_row = 0;
+                                uint32_t step = pw ? channels : 1;
+
+                                for (int row = 0; row < in_rows; row++)
+                                {
+                                    if (pw)
+                                        index = row*in_width*channels + c;
+                                    else
+                                        index = c*slots*pitch + (phase*phase_rows + phase_row)*pitch;
+
+                                    if (row >= top && row < bottom)
+                                    {
+                                        // Halo columns are zeros
+                                        for (int col = 0; col < in_width - mem_cols; col++)
+                                        {
+                                            HLS_BREAK_DEP(plm_in_ping);
+                                            HLS_BREAK_DEP(plm_in_pong);
+                                            wait();
+                                            uint32_t word = index + ((col < pad) ? col : mem_cols + col)*step;
+                                            if (in_ping)
+                                                plm_in_ping[word] = 0;
+                                            else
+                                                plm_in_pong[word] = 0;
+                                        }
+
+                                        // One beat per cycle, dropping the row padding of the last one
+                                        // and the columns no output reads
+                                        for (int col = 0; col < mem_pitch; col += DMA_WORD_PER_BEAT)
+                                        {
+                                            HLS_BREAK_DEP(plm_in_ping);
+                                            HLS_BREAK_DEP(plm_in_pong);
+
+                                            sc_dt::sc_bv<DMA_WIDTH> dataBv;
+
+                                            dataBv = this->dma_read_chnl.get();
+
+                                            if (pw)
+                                            {
+                                                // Interleaved words are `channels` apart, in the
+                                                // same bank when it is a multiple of the banks:
+                                                // one per cycle
+                                                for (uint16_t k = 0; k < DMA_WORD_PER_BEAT; k++)
+                                                {
+                                                    wait();
+                                                    if (col + k < mem_cols) {
+                                                        sc_dt::sc_int<DATA_WIDTH> data = dataBv.range((k+1) * DATA_WIDTH - 1, k * DATA_WIDTH).to_int64();
+                                                        uint32_t word = index + (pad + col + k)*channels;
+                                                        if (in_ping)
+                                                            plm_in_ping[word] = data;
+                                                        else
+                                                            plm_in_pong[word] = data;
+                                                    }
+                                                }
+                                            }
+                                            else
+                                            {
+                                                wait();
+
+                                                for (uint16_t k = 0; k < DMA_WORD_PER_BEAT; k++)
+                                                {
+                                                    HLS_UNROLL_SIMPLE;
+                                                    if (col + k < mem_cols) {
+                                                        sc_dt::sc_int<DATA_WIDTH> data = dataBv.range((k+1) * DATA_WIDTH - 1, k * DATA_WIDTH).to_int64();
+                                                        uint32_t word = index + pad + col + k;
+                                                        if (in_ping)
+                                                            plm_in_ping[word] = data;
+                                                        else
+                                                            plm_in_pong[word] = data;
+                                                    }
+                                                }
+                                            }
+                                        }
+                                    }
+                                    else
+                                    {
+                                        // Halo rows are zeros, interleaved ones one word per cycle
+                                        if (pw)
+                                        {
+                                            for (int col = 0; col < in_width; col++)
+                                            {
+                                                HLS_BREAK_DEP(plm_in_ping);
+                                                HLS_BREAK_DEP(plm_in_pong);
+                                                wait();
+                                                if (in_ping)
+                                                    plm_in_ping[index + col*channels] = 0;
+                                                else
+                                                    plm_in_pong[index + col*channels] = 0;
+                                            }
+                                        }
+                                        else
+                                        {
+                                            for (int col = 0; col < in_width; col += DMA_WORD_PER_BEAT)
+                                            {
+                                                HLS_BREAK_DEP(plm_in_ping);
+                                                HLS_BREAK_DEP(plm_in_pong);
+                                                wait();
+
+                                                for (uint16_t k = 0; k < DMA_WORD_PER_BEAT; k++)
+                                                {
+                                                    HLS_UNROLL_SIMPLE;
+                                                    if (col + k < in_width) {
+                                                        if (in_ping)
+                                                            plm_in_ping[index + col + k] = 0;
+                                                        else
+                                                            plm_in_pong[index + col + k] = 0;
+                                                    }
+                                                }
+                                            }
+                                        }
+                                    }
+
+                                    phase++;
+                                    if (phase == dilation) {
+                                        phase = 0;
+                                        phase_row++;
+                                    }
+                                }
+                            }
+                        }
+
+                        steps++;
+                        this->load_step_done(steps);
+                        if (n == 0 || chunk < Cg) {
+                            slot = (slot == WEIGHT_BUFFERS - 1) ? 0 : slot + 1;
+                            if (pp0 == 0 || !resident)
+                                weight_sets++;
+                        }
                     }
                 }
-                index += DMA_WORD_PER_BEAT;
-                
             }
-
-            need_shift = (index > C*R*S);
-            
-            load_start = false;
-            this->load_compute_handshake();
-            ping = !ping;
         }
-        
+
     }
 
     // Conclude
@@ -281,12 +585,34 @@ void conv::store_output()
         // explicit PLM ports reset if any
 
         // User-defined reset code
+        store_start.write(false);
+        store_filter.write(0);
+        acc_finish.write(false);
 
         wait();
     }
 
     // Config
     /* <<--params-->> */
+    int32_t W;
+    int32_t H;
+    int32_t frac_bits;
+    int32_t coalesce;
+    int32_t block_rows;
+    int32_t stream;
+    int32_t sparse;
+    int32_t winograd;
+    int32_t groups;
+    int32_t pool_avg;
+    int32_t pool_stride;
+    int32_t pool;
+    int32_t relu;
+    int32_t post;
+    int32_t pad;
+    int32_t dilation;
+    int32_t stride;
+    int32_t N;
+    int32_t K;
     int32_t mem_output_addr;
     int32_t mem_input_addr;
     int32_t S;
@@ -295,15 +621,39 @@ void conv::store_output()
     int32_t P;
     int32_t M;
     int32_t C;
+    conf_info_t config;
+    bool specialized;
     {
         HLS_PROTO("store-config");
 
         cfg.wait_for_config(); // config process
-        conf_info_t config = this->conf_info.read();
+        config = this->conf_info.read();
+        specialized = specialize(config);
+
+        // Wide beats may need narrower filter passes to align the output bands
+        config.K = pass_filters(config);
 
-        store_start = false;
         // User-defined config code
         /* <<--local-params-->> */
+        W = config.W;
+        H = config.H;
+        frac_bits = config.frac_bits;
+        coalesce = config.coalesce;
+        block_rows = config.block_rows;
+        stream = config.stream;
+        sparse = config.sparse;
+        winograd = config.winograd;
+        groups = config.groups;
+        pool_avg = config.pool_avg;
+        pool_stride = config.pool_stride;
+        pool = config.pool;
+        relu = config.relu;
+        post = config.post;
+        pad = config.pad;
+        dilation = config.dilation;
+        stride = config.stride;
+        N = config.N;
+        K = config.K;
         mem_output_addr = config.mem_output_addr;
         mem_input_addr = config.mem_input_addr;
         S = config.S;
@@ -314,6 +664,8 @@ void conv::store_output()
         C = config.C;
     }
 
+    uint32_t status = 0;
+
     // Store
     {
         HLS_PROTO("store-dma");
@@ -321,57 +673,165 @@ void conv::store_output()
 
         bool ping = true;
         
-        uint32_t store_offset = round_up(C*(P+R-1)*(Q+S-1)+M*C*R*S, DMA_WORD_PER_BEAT) * 1;
-
-        uint32_t offset = store_offset;
+        uint32_t in_size = in_extent(H, P, R, stride, dilation, pad) * round_up(in_extent(W, Q, S, stride, dilation, pad), DMA_WORD_PER_BEAT);
+        uint32_t store_offset = N*C*in_size + M*filter_words(config) + (post ? round_up(M*POST_PARAMS, DMA_WORD_PER_BEAT) : 0);
+        int32_t out_height = pooled(P, pool, pool_stride);
+        int32_t out_width = pooled(Q, pool, pool_stride);
+        uint32_t out_plane = round_up(out_height*out_width, DMA_WORD_PER_BEAT);
+        int32_t rows = band_rows(config, chunk_channels(config));
+        int32_t band = specialized ? first_band(config, rows) : 0;
+
+        // Average pool windows take pool * pool = 2^pool_shift outputs
+        int32_t pool_shift = 0;
+        for (int b = 1; b < 16; b++)
+            if ((1 << b) <= pool)
+                pool_shift = 2 * b;
+
+        // Coalesced stores merge whole output planes, contiguous in memory, into
+        // bursts of up to STORE_BURST_BEATS beats
+        uint32_t burst_planes = STORE_BURST_BEATS / (out_plane / DMA_WORD_PER_BEAT);
+        if (burst_planes == 0)
+            burst_planes = 1;
+        uint32_t open_planes = 0;
 
         wait();
         
         
 
-        for (int m = 0; m < M; m++)
+        for (int pp0 = 0; band > 0 && pp0 < out_height; pp0 += band, band = next_band(band, rows))
         {
-            
-            this->store_compute_handshake();
+            uint32_t out_length = ((pp0 + band > out_height) ? out_height - pp0 : band) * out_width;
+            bool whole = coalesce && pp0 == 0 && band >= out_height;
 
-            store_start = true;
-            int write_result_start = (int)cycle_counter;
-            // Configure DMA transaction
-            int dma_len;
-            if(m == M - 1)
-                dma_len =  (P*Q) / DMA_WORD_PER_BEAT + 2 + M*3;
-            else
-                dma_len =  (P*Q) / DMA_WORD_PER_BEAT;
+            int32_t filters = 0;
+            for (int m0 = 0; m0 < M; m0 += filters)
+            {
+                int32_t group_end = (m0 / (M/groups) + 1) * (M/groups);
+                filters = (m0 + K > group_end) ? group_end - m0 : K;
 
-            dma_info_t dma_info(offset / DMA_WORD_PER_BEAT, dma_len, DMA_SIZE);
+                for (int n = 0; n < N; n++)
+                {
+                    this->store_compute_handshake();
 
-            offset += P*Q;
+                    // Output of filter m0 + f is at plm_out[(p*Q + q) * K + f]
+                    for (int f = 0; f < filters; f++)
+                    {
+                        int m = m0 + f;
 
-            this->dma_write_ctrl.put(dma_info);
-            //cout << "Start write at " << offset << endl;
+                        store_filter.write(m);
+                        store_start.write(true);
 
-            for (uint16_t i = 0; i < P*Q; i += DMA_WORD_PER_BEAT)
-            {
-                sc_dt::sc_bv<DMA_WIDTH> dataBv;
+                        // Configure DMA transaction, a coalesced burst runs on through the
+                        // next filters, and the next images when a pass covers all M filters
+                        if (open_planes == 0)
+                        {
+                            uint32_t run = 1;
+                            if (whole)
+                                run = (filters == M) ? (N - n)*M - f : filters - f;
+                            open_planes = (run < burst_planes) ? run : burst_planes;
 
-                // Read from PLM
-                wait();
-                for (uint16_t k = 0; k < DMA_WORD_PER_BEAT; k++)
-                {
-                    HLS_UNROLL_SIMPLE;
-                    if (ping)
-                        dataBv.range((k+1) * DATA_WIDTH - 1, k * DATA_WIDTH) = plm_out_ping[i + k];
-                    else
-                        dataBv.range((k+1) * DATA_WIDTH - 1, k * DATA_WIDTH) = plm_out_pong[i + k];
+                            uint32_t offset = store_offset + (n*M + m)*out_plane + pp0*out_width;
+                            int dma_len = open_planes * (round_up(out_length, DMA_WORD_PER_BEAT) / DMA_WORD_PER_BEAT);
+
+                            dma_info_t dma_info(offset / DMA_WORD_PER_BEAT, dma_len, DMA_SIZE);
+
+                            this->dma_write_ctrl.put(dma_info);
+                            //cout << "Start write at " << offset << endl;
+                        }
+                        open_planes--;
+
+                        if (pool == 1 && pool_stride == 1)
+                        {
+                            for (uint16_t i = 0; i < out_length; i += DMA_WORD_PER_BEAT)
+                            {
+                                sc_dt::sc_bv<DMA_WIDTH> dataBv;
+
+                                // Read from PLM, the plane padding of the last beat is zeros.
+                                // Words of a plane are K apart, in the same bank: one per cycle
+                                for (uint16_t k = 0; k < DMA_WORD_PER_BEAT; k++)
+                                {
+                                    wait();
+                                    sc_dt::sc_int<ACC_WIDTH> result = 0;
+                                    if (i + k < out_length) {
+                                        if (ping)
+                                            result = plm_out_ping[(i + k) * K + f];
+                                        else
+                                            result = plm_out_pong[(i + k) * K + f];
+                                    }
+                                    dataBv.range((k+1) * DATA_WIDTH - 1, k * DATA_WIDTH) = result;
+                                }
+                                this->dma_write_chnl.put(dataBv);
+                            }
+                        }
+                        else
+                        {
+                            // Pooling: output (pp, qq) reduces the pool x pool conv outputs
+                            // from row pp * pool_stride and column qq * pool_stride
+                            uint32_t row = 0;
+                            uint32_t col = 0;
+                            uint32_t qq = 0;
+
+                            for (uint16_t i = 0; i < out_length; i += DMA_WORD_PER_BEAT)
+                            {
+                                sc_dt::sc_bv<DMA_WIDTH> dataBv;
+
+                                for (uint16_t k = 0; k < DMA_WORD_PER_BEAT; k++)
+                                {
+                                    sum_t result = 0;
+
+                                    for (uint16_t a = 0; a < pool && i + k < out_length; a++)
+                                    {
+                                        for (uint16_t b = 0; b < pool; b++)
+                                        {
+                                            wait();
+                                            sum_t x;
+                                            uint32_t index = ((row + a) * Q + col + b) * K + f;
+
+                                            if (ping)
+                                                x = to_sum(plm_out_ping[index]);
+                                            else
+                                                x = to_sum(plm_out_pong[index]);
+
+                                            if (pool_avg)
+                                                result += x;
+                                            else if ((a == 0 && b == 0) || x > result)
+                                                result = x;
+                                        }
+                                    }
+
+                                    if (pool_avg)
+                                        result = pool_average(result, pool_shift);
+
+                                    dataBv.range((k+1) * DATA_WIDTH - 1, k * DATA_WIDTH) = to_word(result);
+
+                                    col += pool_stride;
+                                    qq++;
+                                    if (qq == out_width) {
+                                        qq = 0;
+                                        col = 0;
+                                        row += pool_stride;
+                                    }
+                                }
+                                this->dma_write_chnl.put(dataBv);
+                            }
+                        }
+
+                        store_start.write(false);
+                    }
+
+                    ping = !ping;
                 }
-                this->dma_write_chnl.put(dataBv);
             }
-
-            ping = !ping;
-            
-            store_start = false;
         }
-        
+
+        // Layers too large for the PLM profile, or that the accelerator is not
+        // specialized for, are not computed: the status reports it
+        if (band == 0)
+            status = specialized ? STATUS_NO_FIT : STATUS_MISMATCH;
+
+        // The counters and status follow the output in their own burst
+        dma_info_t dma_info((store_offset + N*M*out_plane) / DMA_WORD_PER_BEAT, 3 + M*4, DMA_SIZE);
+        this->dma_write_ctrl.put(dma_info);
     }
 
     {
@@ -379,10 +839,10 @@ void conv::store_output()
         
         HLS_PROTO("store-counter");
         wait();
-        sc_dt::sc_bv<DMA_WIDTH> dataBv1(cycle_counter);
+        sc_dt::sc_bv<DMA_WIDTH> dataBv1(cycle_counter.read());
         this->dma_write_chnl.put(dataBv1);
         wait();
-        sc_dt::sc_bv<DMA_WIDTH> dataBv2(cycle_counter_overflow);
+        sc_dt::sc_bv<DMA_WIDTH> dataBv2(cycle_counter_overflow.read());
         this->dma_write_chnl.put(dataBv2);
         for(int m = 0 ; m < M ; m++){
             wait();
@@ -401,7 +861,20 @@ void conv::store_output()
             sc_dt::sc_bv<DMA_WIDTH> data(result_write_time[m]);
             this->dma_write_chnl.put(data);
         }
-        acc_finish = true;
+
+        for(int m = 0 ; m < M ; m++){
+            wait();
+            sc_dt::sc_bv<DMA_WIDTH> data(compute_stall_time[m]);
+            this->dma_write_chnl.put(data);
+        }
+
+        // Status
+        wait();
+        if (acc_overflow.read())
+            status |= STATUS_OVERFLOW;
+        sc_dt::sc_bv<DMA_WIDTH> dataBv3(status);
+        this->dma_write_chnl.put(dataBv3);
+        acc_finish.write(true);
 
     }
 
@@ -425,12 +898,37 @@ void conv::compute_kernel()
         // explicit PLM ports reset if any
 
         // User-defined reset code
-        compute_start = false;
+        compute_start.write(false);
+        compute_filter.write(0);
+        weight_sets_done.write(0);
+        in_released.write(0);
+        acc_overflow.write(false);
+        compute_stall.write(false);
+        compute_filters.write(0);
         wait();
     }
 
     // Config
     /* <<--params-->> */
+    int32_t W;
+    int32_t H;
+    int32_t frac_bits;
+    int32_t coalesce;
+    int32_t block_rows;
+    int32_t stream;
+    int32_t sparse;
+    int32_t winograd;
+    int32_t groups;
+    int32_t pool_avg;
+    int32_t pool_stride;
+    int32_t pool;
+    int32_t relu;
+    int32_t post;
+    int32_t pad;
+    int32_t dilation;
+    int32_t stride;
+    int32_t N;
+    int32_t K;
     int32_t mem_output_addr;
     int32_t mem_input_addr;
     int32_t S;
@@ -439,14 +937,39 @@ void conv::compute_kernel()
     int32_t P;
     int32_t M;
     int32_t C;
+    conf_info_t config;
+    bool specialized;
     {
         HLS_PROTO("compute-config");
 
         cfg.wait_for_config(); // config process
-        conf_info_t config = this->conf_info.read();
+        config = this->conf_info.read();
+        specialized = specialize(config);
+
+        // Wide beats may need narrower filter passes to align the output bands
+        config.K = pass_filters(config);
 
         // User-defined config code
         /* <<--local-params-->> */
+        W = config.W;
+        H = config.H;
+        frac_bits = config.frac_bits;
+        coalesce = config.coalesce;
+        block_rows = config.block_rows;
+        stream = config.stream;
+        sparse = config.sparse;
+        winograd = config.winograd;
+        groups = config.groups;
+        pool_avg = config.pool_avg;
+        pool_stride = config.pool_stride;
+        pool = config.pool;
+        relu = config.relu;
+        post = config.post;
+        pad = config.pad;
+        dilation = config.dilation;
+        stride = config.stride;
+        N = config.N;
+        K = config.K;
         mem_output_addr = config.mem_output_addr;
         mem_input_addr = config.mem_input_addr;
         S = config.S;
@@ -459,63 +982,547 @@ void conv::compute_kernel()
 
 
     // Compute
-    bool ping = true;
+    uint32_t slot = 0;
+    uint32_t steps = 0;
+    uint32_t weight_sets = 0;
+    bool in_ping = false;
+    uint32_t in_loads = 0;
+    uint32_t in_releases = 0;
+    bool out_ping = true;
+    bool overflow = false;
+    int32_t out_height = pooled(P, pool, pool_stride);
+    int32_t Cg = C / groups;
+    int32_t Mg = M / groups;
+    int32_t chunk = chunk_channels(config);
+    int32_t rows = band_rows(config, chunk);
+    int32_t band = specialized ? first_band(config, rows) : 0;
+    int32_t in_width = in_span(Q, S, stride, dilation);
+    int32_t pitch = in_pitch(in_width);
+    int32_t cols = window_cols(dilation);
+    int32_t taps = kernel_words(config);
+    bool wino = winograd_mode(config);
+    bool pw = pointwise_mode(config);
+    bool resident = weights_resident(config, chunk);
     {
-        for(int m = 0 ; m < M ; m++){
-            this->compute_load_handshake();
-            compute_start = true;
-            {
-                for (int p = 0 ; p < P ; p++){
-                    wait();
-                    for (int q = 0 ; q < Q ; q++){
-
-                        wait();
-                        sc_dt::sc_int<DATA_WIDTH> acc = 0;
-
-                        int gold_index = p*Q +q;
-                        // if(ping)
-                        //     plm_out_ping[gold_index] = 0;
-                        // else
-                        //     plm_out_pong[gold_index] = 0;
-
-                        for (int c = 0 ; c < C ; c++){
-                            wait();
-                            for (int r = 0 ; r < R ; r++){
+        for (int pp0 = 0 ; band > 0 && pp0 < out_height ; pp0 += band, band = next_band(band, rows)){
+            if (resident)
+                slot = 0;
+
+            // Conv rows pooled by the band
+            int32_t out_rows = in_span((pp0 + band > out_height) ? out_height - pp0 : band, pool, pool_stride, 1);
+            int32_t slots = in_slots(in_span(out_rows, R, stride, dilation), dilation);
+            int32_t phase_rows = slots / dilation;
+
+            int32_t filters = 0;
+            for(int m0 = 0 ; m0 < M ; m0 += filters){
+                int32_t group_end = (m0 / Mg + 1) * Mg;
+                filters = (m0 + K > group_end) ? group_end - m0 : K;
+
+                for (int n = 0 ; n < N ; n++){
+                    for (int c0 = 0 ; c0 < Cg ; c0 += chunk){
+                        int32_t channels = (c0 + chunk > Cg) ? Cg - c0 : chunk;
+
+                        compute_filter.write(m0);
+                        compute_filters.write(filters);
+                        this->compute_step_wait(steps);
+                        compute_start.write(true);
+
+                        // Follow load across the input buffers. The buffer of the previous
+                        // input is no longer read: release it to load, which refills it with
+                        // the next chunk, image, conv group or band while this pass computes
+                        if (chunk < Cg || N > 1 || m0 % Mg == 0) {
+                            if (in_loads > 0) {
+                                in_releases++;
+                                in_released.write(in_releases);
+                            }
+                            in_ping = !in_ping;
+                            in_loads++;
+                        }
+
+                        // Bias, multiplier and shift of every filter follow the last chunk weights
+                        sc_dt::sc_int<DATA_WIDTH> post_param[POST_PARAMS][FILTERS_MAX];
+                        HLS_FLAT(post_param);
+
+                        if (post && c0 + chunk >= Cg){
+                            for (int i = 0 ; i < POST_PARAMS ; i++){
                                 wait();
-                                for (int s = 0 ; s < S ; s++){
+                                int param_index = (channels*taps + i) * K;
+
+                                for (int f = 0 ; f < FILTERS_MAX ; f++){
+                                    HLS_UNROLL_SIMPLE;
+                                    post_param[i][f] = 0;
+                                    if (f < filters)
+                                        post_param[i][f] = this->weight_read(slot, param_index + f);
+                                }
+                            }
+                        }
+
+                        // 1x1 layers: every output reduces PLM_IN_BANKS interleaved channels
+                        // per cycle, and plm_out is updated once per block of channels
+                        for (int b0 = 0 ; pw && b0 < channels ; b0 += PLM_IN_BANKS){
 
-                                    HLS_PROTO("compute-kernel");
-                                    HLS_UNROLL_LOOP(AGGRESSIVE, 5, "inner_loop");
-                                    HLS_CONSTRAIN_LATENCY(1, 5, "inner");
+                            sc_dt::sc_int<DATA_WIDTH> w[FILTERS_MAX][PLM_IN_BANKS];
+                            HLS_FLAT(w);
+
+                            for (int b = 0 ; b < PLM_IN_BANKS ; b++){
+                                wait();
+                                int weight_index = (b0 + b) * K;
+
+                                for (int f = 0 ; f < FILTERS_MAX ; f++){
+                                    HLS_UNROLL_SIMPLE;
+                                    w[f][b] = 0;
+                                    if (f < filters && b0 + b < channels)
+                                        w[f][b] = this->weight_read(slot, weight_index + f);
+                                }
+                            }
+
+                            // The last block of channels of the last chunk finishes the outputs
+                            bool first = (c0 + b0 == 0);
+                            bool finish = (c0 + chunk >= Cg) && (b0 + PLM_IN_BANKS >= channels);
+
+                            // Output (p, q) reads input (p * stride, q * stride)
+                            int32_t p = 0;
+                            int32_t q = 0;
+                            int in_index = b0;
+
+                            for (int i = 0 ; i < out_rows * Q ; i++){
+
+                                HLS_PIPE("gemm");
+
+                                sc_dt::sc_int<DATA_WIDTH> in[PLM_IN_BANKS];
+                                HLS_FLAT(in);
+
+                                for (int b = 0 ; b < PLM_IN_BANKS ; b++){
+                                    HLS_UNROLL_SIMPLE;
+                                    in[b] = 0;
+                                    if (b0 + b < channels) {
+                                        if (in_ping)
+                                            in[b] = plm_in_ping[in_index + b];
+                                        else
+                                            in[b] = plm_in_pong[in_index + b];
+                                    }
+                                }
+
+                                for (int f = 0 ; f < FILTERS_MAX ; f++){
+                                    HLS_UNROLL_SIMPLE;
+                                    if (f < filters) {
+                                        sum_t acc = 0;
+
+                                        for (int b = 0 ; b < PLM_IN_BANKS ; b++){
+                                            HLS_UNROLL_SIMPLE;
+                                            acc += product(in[b], w[f][b]);
+                                        }
+
+                                        if (!first) {
+                                            if(out_ping)
+                                                acc += to_sum(plm_out_ping[i * K + f]);
+                                            else
+                                                acc += to_sum(plm_out_pong[i * K + f]);
+                                        }
+
+                                        // Partial sums keep the accumulator width, finished outputs saturate
+                                        sc_dt::sc_int<ACC_WIDTH> word = to_word(acc);
+                                        if (finish)
+                                            word = saturate(post_process(acc, post, relu, post_param[0][f],
+                                                                         post_param[1][f], post_param[2][f], frac_bits), overflow);
+
+                                        if(out_ping)
+                                            plm_out_ping[i * K + f] = word;
+                                        else
+                                            plm_out_pong[i * K + f] = word;
+                                    }
+                                }
+
+                                q++;
+                                in_index += stride * channels;
+                                if (q == Q) {
+                                    q = 0;
+                                    p++;
+                                    in_index = (p * stride * in_width) * channels + b0;
+                                }
+                            }
+                        }
+
+                        // Sparse filters: every nonzero (c, r, s) tap of a filter is applied to
+                        // the whole band, so the MACs scale with the weight density. The counts
+                        // are at plm_weight[c * K + f], the entries from plm_weight[channels * K + f].
+                        for (int f = 0 ; sparse && f < filters ; f++){
+                            int32_t out_words = out_rows * Q;
+                            int entry = channels;
+
+                            if (c0 == 0){
+                                for (int i = 0 ; i < out_words ; i++){
+                                    HLS_PIPE("sparse-clear");
+                                    if(out_ping)
+                                        plm_out_ping[i * K + f] = 0;
+                                    else
+                                        plm_out_pong[i * K + f] = 0;
+                                }
+                            }
+
+                            for (int c = 0 ; c < channels ; c++){
+                                sc_dt::sc_int<DATA_WIDTH> nnz;
+                                wait();
+                                nnz = this->weight_read(slot, c * K + f);
+
+                                for (int e = 0 ; e < nnz ; e++){
+                                    sc_dt::sc_int<DATA_WIDTH> tap;
+                                    sc_dt::sc_int<DATA_WIDTH> weight;
                                     wait();
-                                    int input_index = c*(P+R-1)*(Q+S-1) + (p+r)*(Q+S-1) + (q+s);
-                                    int weight_index = c*R*S + r*S + s;
-                                    
-                                    if(ping) {
-                                        wait();
-                                        acc += plm_in[input_index] * plm_weight_ping[weight_index];
+                                    tap = this->weight_read(slot, entry * K + f);
+                                    weight = this->weight_read(slot, (entry + 1) * K + f);
+                                    entry += 2;
+
+                                    int32_t r = tap / S;
+                                    int32_t s = tap % S;
+
+                                    for (int p = 0 ; p < out_rows ; p++){
+                                        // Kernel row r of output row p is in slot y / dilation + r of phase y % dilation
+                                        int32_t y = p * stride;
+                                        int row_index = c*slots*pitch + ((y % dilation)*phase_rows + y / dilation + r)*pitch + s*dilation;
+                                        int gold_index = p * Q * K + f;
+
+                                        for (int q = 0 ; q < Q ; q++){
+                                            HLS_PIPE("sparse-mac");
+                                            sc_dt::sc_int<DATA_WIDTH> in;
+                                            if (in_ping)
+                                                in = plm_in_ping[row_index + q*stride];
+                                            else
+                                                in = plm_in_pong[row_index + q*stride];
+                                            sum_t acc = product(in, weight);
+
+                                            if(out_ping)
+                                                plm_out_ping[gold_index] = to_word(to_sum(plm_out_ping[gold_index]) + acc);
+                                            else
+                                                plm_out_pong[gold_index] = to_word(to_sum(plm_out_pong[gold_index]) + acc);
+                                            gold_index += K;
+                                        }
                                     }
-                                    else{
+                                }
+                            }
+
+                            // The last chunk finishes the outputs
+                            if (c0 + chunk >= Cg){
+                                for (int i = 0 ; i < out_words ; i++){
+                                    HLS_PIPE("sparse-post");
+                                    if(out_ping)
+                                        plm_out_ping[i * K + f] = saturate(post_process(to_sum(plm_out_ping[i * K + f]), post, relu, post_param[0][f],
+                                                                               post_param[1][f], post_param[2][f], frac_bits), overflow);
+                                    else
+                                        plm_out_pong[i * K + f] = saturate(post_process(to_sum(plm_out_pong[i * K + f]), post, relu, post_param[0][f],
+                                                                               post_param[1][f], post_param[2][f], frac_bits), overflow);
+                                }
+                            }
+                        }
+
+                        // Kernels larger than MAC_ROWS x cols are split in sub-kernels
+                        for (int c = 0 ; !pw && !sparse && c < channels ; c++){
+
+                            // Winograd F(2x2,3x3): every 4x4 input tile gives a 2x2 output tile
+                            // with 16 multiplications per filter instead of 36
+                            if (wino){
+
+                                // Transformed weights U of the channel for every filter
+                                sc_dt::sc_int<DATA_WIDTH> u[FILTERS_MAX][WINO_TILE * WINO_TILE];
+                                HLS_FLAT(u);
+
+                                for (int i = 0 ; i < WINO_TILE * WINO_TILE ; i++){
+                                    wait();
+                                    int weight_index = (c*taps + i) * K;
+
+                                    for (int f = 0 ; f < FILTERS_MAX ; f++){
+                                        HLS_UNROLL_SIMPLE;
+                                        u[f][i] = 0;
+                                        if (f < filters)
+                                            u[f][i] = this->weight_read(slot, weight_index + f);
+                                    }
+                                }
+
+                                bool first = (c0 + c == 0);
+                                bool finish = (c0 + c == Cg - 1);
+
+                                // Output rows p and p + 1 read input rows p to p + 3
+                                for (int p = 0 ; p < out_rows ; p += 2){
+
+                                    // Input tile: column s of row r holds input column q + s
+                                    sc_dt::sc_int<DATA_WIDTH> d[WINO_TILE][WINO_TILE];
+                                    HLS_FLAT(d);
+
+                                    for (int r = 0 ; r < WINO_TILE ; r++){
+                                        HLS_UNROLL_SIMPLE;
+                                        for (int s = 0 ; s < WINO_TILE ; s++){
+                                            HLS_UNROLL_SIMPLE;
+                                            d[r][s] = 0;
+                                        }
+                                    }
+                                    wait();
+
+                                    int row_index = c*slots*pitch + p*pitch;
+
+                                    // Tile q is complete when column q + 3 is shifted in, tiles step by 2.
+                                    // Its outputs of row p are written then, those of row p + 1 on the
+                                    // next iteration, so every iteration writes 2 * filters words
+                                    int32_t next = WINO_TILE - 1;
+                                    int32_t q = 0;
+                                    sc_dt::sc_int<SUM_WIDTH> y[FILTERS_MAX][2][2];
+                                    HLS_FLAT(y);
+
+                                    for (int j = 0 ; j < (Q - 1) / 2 * 2 + WINO_TILE + 1 ; j++){
+
+                                        HLS_PIPE("winograd");
+
+                                        // Rows and columns past the band read zeros
+                                        for (int r = 0 ; r < WINO_TILE ; r++){
+                                            HLS_UNROLL_SIMPLE;
+                                            sc_dt::sc_int<DATA_WIDTH> in = 0;
+                                            if (p + r < slots && j < Q + 2) {
+                                                if (in_ping)
+                                                    in = plm_in_ping[row_index + r*pitch + j];
+                                                else
+                                                    in = plm_in_pong[row_index + r*pitch + j];
+                                            }
+
+                                            for (int s = 0 ; s < WINO_TILE - 1 ; s++){
+                                                HLS_UNROLL_SIMPLE;
+                                                d[r][s] = d[r][s + 1];
+                                            }
+                                            d[r][WINO_TILE - 1] = in;
+                                        }
+
+                                        bool tile = (j == next);
+                                        if (!tile && (j != next - 1 || q == 0))
+                                            continue;
+
+                                        if (tile) {
+                                            // Input transform V = B^T d B
+                                            sc_dt::sc_int<DATA_WIDTH + 2> t[WINO_TILE][WINO_TILE];
+                                            sc_dt::sc_int<DATA_WIDTH + 2> v[WINO_TILE][WINO_TILE];
+                                            HLS_FLAT(t);
+                                            HLS_FLAT(v);
+
+                                            for (int s = 0 ; s < WINO_TILE ; s++){
+                                                HLS_UNROLL_SIMPLE;
+                                                t[0][s] = d[0][s] - d[2][s];
+                                                t[1][s] = d[1][s] + d[2][s];
+                                                t[2][s] = d[2][s] - d[1][s];
+                                                t[3][s] = d[1][s] - d[3][s];
+                                            }
+                                            for (int r = 0 ; r < WINO_TILE ; r++){
+                                                HLS_UNROLL_SIMPLE;
+                                                v[r][0] = t[r][0] - t[r][2];
+                                                v[r][1] = t[r][1] + t[r][2];
+                                                v[r][2] = t[r][2] - t[r][1];
+                                                v[r][3] = t[r][1] - t[r][3];
+                                            }
+
+                                            // Output transform A^T (U .* V) A: the weights are scaled
+                                            // by 4, so are the tile outputs until the last channel
+                                            for (int f = 0 ; f < FILTERS_MAX ; f++){
+                                                HLS_UNROLL_SIMPLE;
+                                                sc_dt::sc_int<SUM_WIDTH> e[2][WINO_TILE];
+                                                HLS_FLAT(e);
+
+                                                for (int s = 0 ; s < WINO_TILE ; s++){
+                                                    HLS_UNROLL_SIMPLE;
+                                                    sc_dt::sc_int<SUM_WIDTH> uv0 = u[f][s] * v[0][s];
+                                                    sc_dt::sc_int<SUM_WIDTH> uv1 = u[f][WINO_TILE + s] * v[1][s];
+                                                    sc_dt::sc_int<SUM_WIDTH> uv2 = u[f][2*WINO_TILE + s] * v[2][s];
+                                                    sc_dt::sc_int<SUM_WIDTH> uv3 = u[f][3*WINO_TILE + s] * v[3][s];
+                                                    e[0][s] = uv0 + uv1 + uv2;
+                                                    e[1][s] = uv1 - uv2 - uv3;
+                                                }
+                                                for (int r = 0 ; r < 2 ; r++){
+                                                    HLS_UNROLL_SIMPLE;
+                                                    y[f][r][0] = e[r][0] + e[r][1] + e[r][2];
+                                                    y[f][r][1] = e[r][1] - e[r][2] - e[r][3];
+                                                }
+                                            }
+                                        }
+
+                                        // Row p of the tile just completed, or row p + 1 of the previous one
+                                        int32_t r = tile ? 0 : 1;
+                                        int32_t q0 = tile ? q : q - 2;
+
+                                        for (int f = 0 ; f < FILTERS_MAX ; f++){
+                                            HLS_UNROLL_SIMPLE;
+                                            for (int s = 0 ; s < 2 ; s++){
+                                                HLS_UNROLL_SIMPLE;
+                                                if (f < filters && p + r < out_rows && q0 + s < Q) {
+                                                    int gold_index = ((p + r)*Q + q0 + s) * K;
+                                                    sc_dt::sc_int<SUM_WIDTH> acc = y[f][r][s];
+
+                                                    if (!first) {
+                                                        if(out_ping)
+                                                            acc += plm_out_ping[gold_index + f];
+                                                        else
+                                                            acc += plm_out_pong[gold_index + f];
+                                                    }
+
+                                                    // The sums of all channels are exact multiples of 4
+                                                    sc_dt::sc_int<ACC_WIDTH> word = to_word(acc);
+                                                    if (finish)
+                                                        word = saturate(post_process(acc >> 2, post, relu, post_param[0][f],
+                                                                                     post_param[1][f], post_param[2][f], frac_bits), overflow);
+
+                                                    if(out_ping)
+                                                        plm_out_ping[gold_index + f] = word;
+                                                    else
+                                                        plm_out_pong[gold_index + f] = word;
+                                                }
+                                            }
+                                        }
+
+                                        if (tile) {
+                                            next += 2;
+                                            q += 2;
+                                        }
+                                    }
+                                }
+
+                                continue;
+                            }
+
+                            for (int r0 = 0 ; r0 < R ; r0 += MAC_ROWS){
+                                for (int s0 = 0 ; s0 < S ; s0 += cols){
+
+                                    int32_t sk = (S - s0 < cols) ? S - s0 : cols;
+                                    int32_t span = (sk - 1) * dilation + 1;
+
+                                    // Weights of the sub-kernel for every filter of the group
+                                    sc_dt::sc_int<DATA_WIDTH> w[FILTERS_MAX][MAC_ROWS * MAC_COLS];
+                                    HLS_FLAT(w);
+
+                                    for (int r = 0 ; r < MAC_ROWS ; r++){
+                                        for (int s = 0 ; s < MAC_COLS ; s++){
+                                            wait();
+                                            int weight_index = (c*R*S + (r0+r)*S + (s0+s)) * K;
+
+                                            for (int f = 0 ; f < FILTERS_MAX ; f++){
+                                                HLS_UNROLL_SIMPLE;
+                                                w[f][r*MAC_COLS + s] = 0;
+                                                if (f < filters && r0 + r < R && s < sk)
+                                                    w[f][r*MAC_COLS + s] = this->weight_read(slot, weight_index + f);
+                                            }
+                                        }
+                                    }
+
+                                    bool first = (c0 + c == 0) && (r0 == 0) && (s0 == 0);
+                                    bool finish = (c0 + c == Cg - 1) && (r0 + MAC_ROWS >= R) && (s0 + cols >= S);
+
+                                    for (int p = 0 ; p < out_rows ; p++){
+
+                                        // Sliding window: column s of row r holds input column q * stride + s0 * dilation + s
+                                        sc_dt::sc_int<DATA_WIDTH> win[MAC_ROWS][WINDOW_MAX];
+                                        HLS_FLAT(win);
+
+                                        for (int r = 0 ; r < MAC_ROWS ; r++){
+                                            HLS_UNROLL_SIMPLE;
+                                            for (int s = 0 ; s < WINDOW_MAX ; s++){
+                                                HLS_UNROLL_SIMPLE;
+                                                win[r][s] = 0;
+                                            }
+                                        }
                                         wait();
-                                        acc += plm_in[input_index] * plm_weight_pong[weight_index];
-                                     }
+
+                                        // Kernel row r0 + r of output row p is in slot y / dilation + r0 + r of phase y % dilation
+                                        int32_t y = p * stride;
+                                        int row_index = c*slots*pitch + ((y % dilation)*phase_rows + y / dilation + r0)*pitch + s0*dilation;
+
+                                        // Output q is complete when column q * stride + span - 1 is shifted in
+                                        int32_t next = span - 1;
+                                        int32_t q = 0;
+
+                                        for (int j = 0 ; j < (Q - 1) * stride + span ; j++){
+
+                                            HLS_PIPE("mac-array");
+
+                                            // Shift in one column: R reads from distinct banks of plm_in
+                                            for (int r = 0 ; r < MAC_ROWS ; r++){
+                                                HLS_UNROLL_SIMPLE;
+                                                sc_dt::sc_int<DATA_WIDTH> in = 0;
+                                                if (r0 + r < R) {
+                                                    if (in_ping)
+                                                        in = plm_in_ping[row_index + r*pitch + j];
+                                                    else
+                                                        in = plm_in_pong[row_index + r*pitch + j];
+                                                }
+
+                                                for (int s = 0 ; s < WINDOW_MAX ; s++){
+                                                    HLS_UNROLL_SIMPLE;
+                                                    if (s < span - 1)
+                                                        win[r][s] = win[r][s + 1];
+                                                    else if (s == span - 1)
+                                                        win[r][s] = in;
+                                                }
+                                            }
+
+                                            if (j != next)
+                                                continue;
+
+                                            int gold_index = (p*Q + q) * K;
+                                            next += stride;
+                                            q++;
+
+                                            for (int f = 0 ; f < FILTERS_MAX ; f++){
+                                                HLS_UNROLL_SIMPLE;
+                                                if (f < filters) {
+                                                    sum_t acc = 0;
+
+                                                    for (int r = 0 ; r < MAC_ROWS ; r++){
+                                                        HLS_UNROLL_SIMPLE;
+                                                        for (int s = 0 ; s < MAC_COLS ; s++){
+                                                            HLS_UNROLL_SIMPLE;
+                                                            if (s < sk)
+                                                                acc += product(win[r][s * dilation], w[f][r*MAC_COLS + s]);
+                                                        }
+                                                    }
+
+                                                    // Accumulate on the partial sum of the previous channels
+                                                    if (!first) {
+                                                        if(out_ping)
+                                                            acc += to_sum(plm_out_ping[gold_index + f]);
+                                                        else
+                                                            acc += to_sum(plm_out_pong[gold_index + f]);
+                                                    }
+
+                                                    // The last sub-kernel of the last channel finishes the output
+                                                    sc_dt::sc_int<ACC_WIDTH> word = to_word(acc);
+                                                    if (finish)
+                                                        word = saturate(post_process(acc, post, relu, post_param[0][f],
+                                                                                     post_param[1][f], post_param[2][f], frac_bits), overflow);
+
+                                                    if(out_ping)
+                                                        plm_out_ping[gold_index + f] = word;
+                                                    else
+                                                        plm_out_pong[gold_index + f] = word;
+                                                }
+                                            }
+                                        }
+                                    }
                                 }
                             }
                         }
-                        
-                        if(ping)
-                            plm_out_ping[gold_index] = acc;
-                        else
-                            plm_out_pong[gold_index] = acc;
+
+
+                        compute_start.write(false);
+                        steps++;
+                        acc_overflow.write(overflow);
+
+                        // The pass weights stay resident across the batch unless Cg is chunked,
+                        // then their buffer goes back to load; resident sets are never released
+                        if (n == N - 1 || chunk < Cg) {
+                            slot = (slot == WEIGHT_BUFFERS - 1) ? 0 : slot + 1;
+                            if (!resident) {
+                                weight_sets++;
+                                weight_sets_done.write(weight_sets);
+                            }
+                        }
                     }
+
+                    this->compute_store_handshake();
+                    out_ping = !out_ping;
                 }
             }
-            
-    
-            compute_start = false;
-
-            this->compute_store_handshake();
-            ping = !ping;
         }
         
 
@@ -14,11 +14,52 @@
 #define __round_mask(x, y) ((y)-1)
 #define round_up(x, y) ((((x)-1) | __round_mask(x, y))+1)
 /* <<--defines-->> */
-#define DATA_WIDTH 32
-#define DMA_SIZE SIZE_WORD
-#define PLM_OUT_WORD 1200
-#define PLM_IN_WORD 4000
-#define PLM_WEIGHT_WORD 1200
+#define PLM_OUT_WORD PLM_OUT_SIZE
+#define PLM_IN_WORD (PLM_IN_SIZE * 32 / DATA_WIDTH)
+#define PLM_WEIGHT_WORD (PLM_WEIGHT_SIZE * 32 / DATA_WIDTH)
+#define FILTERS_MAX 8
+#define KERNEL_MAX 5
+#define WINDOW_MAX 9
+#define POST_PARAMS 3
+#define WINO_TILE 4
+#define STORE_BURST_BEATS 256
+#define COUNTERS_MAX 50
+
+// MAC array of the direct convolution: KERNEL_MAX x KERNEL_MAX taps, or the
+// kernel of a specialized accelerator when it is smaller
+#if defined(CONV_R) && (CONV_R < KERNEL_MAX)
+#define MAC_ROWS CONV_R
+#else
+#define MAC_ROWS KERNEL_MAX
+#endif
+#if defined(CONV_S) && (CONV_S < KERNEL_MAX)
+#define MAC_COLS CONV_S
+#else
+#define MAC_COLS KERNEL_MAX
+#endif
+
+// The sliding window reads its MAC_ROWS rows from distinct banks of plm_in
+#if (PLM_IN_BANKS < MAC_ROWS)
+#error PLM_IN_BANKS must cover the MAC_ROWS rows of the sliding window
+#endif
+
+// Status word after the counters: a finished output saturated, no band of
+// the layer fits the PLM profile, the layer does not match the kernel of a
+// specialized accelerator or averages a pool whose side is not a power of
+// two (nothing was computed)
+#define STATUS_OVERFLOW 0x1
+#define STATUS_NO_FIT 0x2
+#define STATUS_MISMATCH 0x4
+
+// plm_out words hold the partial sums at the accumulator width, fp32 sums
+// as IEEE-754 words
+#if defined(DATA_FP32)
+#define ACC_WIDTH 32
+typedef float sum_t;
+#else
+#define ACC_WIDTH SUM_WIDTH
+typedef sc_dt::sc_int<SUM_WIDTH> sum_t;
+#endif
 
 class conv : public esp_accelerator_3P<DMA_WIDTH>
 {
@@ -28,6 +69,23 @@ public:
     conv(const sc_module_name& name)
     : esp_accelerator_3P<DMA_WIDTH>(name)
         , cfg("config")
+        , acc_start("acc_start")
+        , acc_finish("acc_finish")
+        , cycle_counter("cycle_counter")
+        , cycle_counter_overflow("cycle_counter_overflow")
+        , load_start("load_start")
+        , compute_start("compute_start")
+        , store_start("store_start")
+        , load_filter("load_filter")
+        , compute_filter("compute_filter")
+        , store_filter("store_filter")
+        , load_steps("load_steps")
+        , weight_sets_done("weight_sets_done")
+        , in_released("in_released")
+        , acc_overflow("acc_overflow")
+        , load_filters("load_filters")
+        , compute_stall("compute_stall")
+        , compute_filters("compute_filters")
     {
         // Signal binding
         cfg.bind_with(*this);
@@ -36,9 +94,16 @@ public:
         /* <<--plm-bind-->> */
         HLS_MAP_plm(plm_out_pong, PLM_OUT_NAME);
         HLS_MAP_plm(plm_out_ping, PLM_OUT_NAME);
-        HLS_MAP_plm(plm_in, PLM_IN_NAME);
-        HLS_MAP_plm(plm_weight_pong, PLM_WEIGHT_NAME);
-        HLS_MAP_plm(plm_weight_ping, PLM_WEIGHT_NAME);
+        HLS_MAP_plm(plm_in_pong, PLM_IN_NAME);
+        HLS_MAP_plm(plm_in_ping, PLM_IN_NAME);
+#if (WEIGHT_BUFFERS > 3)
+        HLS_MAP_plm(plm_weight_3, PLM_WEIGHT_NAME);
+#endif
+#if (WEIGHT_BUFFERS > 2)
+        HLS_MAP_plm(plm_weight_2, PLM_WEIGHT_NAME);
+#endif
+        HLS_MAP_plm(plm_weight_1, PLM_WEIGHT_NAME);
+        HLS_MAP_plm(plm_weight_0, PLM_WEIGHT_NAME);
 
         
         SC_CTHREAD(clock_cycle_counter, this->clk.pos());
@@ -76,20 +141,90 @@ public:
     esp_config_proc cfg;
 
     // Functions
-    bool acc_start, acc_finish;
-    uint32_t cycle_counter;
-    bool cycle_counter_overflow;
-    bool load_start, compute_start, store_start;
-    int weight_load_time[50];
-    int result_write_time[50];
-    int kernel_compute_time[50];
+    inline void load_weight_wait(uint32_t sets);
+    inline void load_input_wait(uint32_t loads);
+    inline void load_step_done(uint32_t steps);
+    inline void compute_step_wait(uint32_t steps);
+    inline sc_dt::sc_int<DATA_WIDTH> weight_read(uint32_t slot, uint32_t index);
+    inline void weight_write(uint32_t slot, uint32_t index, sc_dt::sc_int<DATA_WIDTH> data);
+    inline bool specialize(conf_info_t &config);
+    inline int32_t in_span(int32_t out, int32_t kernel, int32_t stride, int32_t dilation);
+    inline int32_t in_extent(int32_t size, int32_t out, int32_t kernel, int32_t stride, int32_t dilation, int32_t pad);
+    inline int32_t in_slots(int32_t rows, int32_t dilation);
+    inline int32_t in_pitch(int32_t width);
+    inline int32_t window_cols(int32_t dilation);
+    inline int32_t band_align(int32_t Q);
+    inline int32_t pooled(int32_t size, int32_t pool, int32_t pool_stride);
+    inline bool winograd_mode(const conf_info_t &config);
+    inline int32_t kernel_words(const conf_info_t &config);
+    inline int32_t filter_words(const conf_info_t &config);
+    inline bool pointwise_mode(const conf_info_t &config);
+    inline int32_t chunk_channels(const conf_info_t &config);
+    inline int32_t band_rows(const conf_info_t &config, int32_t chunk);
+    inline int32_t first_band(const conf_info_t &config, int32_t rows);
+    inline int32_t next_band(int32_t band, int32_t rows);
+    inline int32_t pass_filters(const conf_info_t &config);
+    inline bool weights_resident(const conf_info_t &config, int32_t chunk);
+    inline float to_float(sc_dt::sc_int<32> word);
+    inline sc_dt::sc_int<32> from_float(float x);
+    inline sum_t product(sc_dt::sc_int<DATA_WIDTH> a, sc_dt::sc_int<DATA_WIDTH> b);
+    inline sum_t to_sum(sc_dt::sc_int<ACC_WIDTH> word);
+    inline sc_dt::sc_int<ACC_WIDTH> to_word(sum_t acc);
+    inline sum_t pool_average(sum_t sum, int32_t shift);
+    inline sum_t post_process(sum_t acc, bool post, bool relu,
+                              sc_dt::sc_int<DATA_WIDTH> bias,
+                              sc_dt::sc_int<DATA_WIDTH> scale,
+                              sc_dt::sc_int<DATA_WIDTH> shift,
+                              int32_t frac_bits);
+    inline sc_dt::sc_int<ACC_WIDTH> saturate(sum_t acc, bool &overflow);
+
+    // Performance counters: each thread raises its start flag with the
+    // first filter of its current transfer (pass), the counter threads
+    // sample them a cycle later
+    sc_signal<bool> acc_start;
+    sc_signal<bool> acc_finish;
+    sc_signal<uint32_t> cycle_counter;
+    sc_signal<bool> cycle_counter_overflow;
+    sc_signal<bool> load_start;
+    sc_signal<bool> compute_start;
+    sc_signal<bool> store_start;
+    sc_signal<uint32_t> load_filter;
+    sc_signal<uint32_t> compute_filter;
+    sc_signal<uint32_t> store_filter;
+    int weight_load_time[COUNTERS_MAX];
+    int result_write_time[COUNTERS_MAX];
+    int kernel_compute_time[COUNTERS_MAX];
+    int compute_stall_time[COUNTERS_MAX];
+
+    // Circular buffers between load and compute, each counter has one writer:
+    // passes whose weights and input are in (load), weight sets and input
+    // buffers compute is done with (compute)
+    sc_signal<uint32_t> load_steps;
+    sc_signal<uint32_t> weight_sets_done;
+    sc_signal<uint32_t> in_released;
+
+    // Sticky: a finished output saturated on its writeback into plm_out
+    sc_signal<bool> acc_overflow;
+
+    // Filters from load_filter (compute_filter) that share the current load
+    // (pass); compute_stall is raised while compute waits for its next pass
+    sc_signal<uint32_t> load_filters;
+    sc_signal<bool> compute_stall;
+    sc_signal<uint32_t> compute_filters;
 
     // Private local memories
-    sc_dt::sc_int<DATA_WIDTH> plm_in[PLM_IN_WORD];
-    sc_dt::sc_int<DATA_WIDTH> plm_weight_ping[PLM_WEIGHT_WORD];
-    sc_dt::sc_int<DATA_WIDTH> plm_weight_pong[PLM_WEIGHT_WORD];
-    sc_dt::sc_int<DATA_WIDTH> plm_out_ping[PLM_OUT_WORD];
-    sc_dt::sc_int<DATA_WIDTH> plm_out_pong[PLM_OUT_WORD];
+    sc_dt::sc_int<DATA_WIDTH> plm_in_ping[PLM_IN_WORD];
+    sc_dt::sc_int<DATA_WIDTH> plm_in_pong[PLM_IN_WORD];
+    sc_dt::sc_int<DATA_WIDTH> plm_weight_0[PLM_WEIGHT_WORD];
+    sc_dt::sc_int<DATA_WIDTH> plm_weight_1[PLM_WEIGHT_WORD];
+#if (WEIGHT_BUFFERS > 2)
+    sc_dt::sc_int<DATA_WIDTH> plm_weight_2[PLM_WEIGHT_WORD];
+#endif
+#if (WEIGHT_BUFFERS > 3)
+    sc_dt::sc_int<DATA_WIDTH> plm_weight_3[PLM_WEIGHT_WORD];
+#endif
+    sc_dt::sc_int<ACC_WIDTH> plm_out_ping[PLM_OUT_WORD];
+    sc_dt::sc_int<ACC_WIDTH> plm_out_pong[PLM_OUT_WORD];
 
 };
 
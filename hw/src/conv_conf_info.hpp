@@ -19,6 +19,25 @@ public:
     conf_info_t()
     {
         /* <<--ctor-->> */
+        this->W = 0;
+        this->H = 0;
+        this->frac_bits = 0;
+        this->coalesce = 0;
+        this->block_rows = 0;
+        this->stream = 0;
+        this->sparse = 0;
+        this->winograd = 0;
+        this->groups = 1;
+        this->pool_avg = 0;
+        this->pool_stride = 2;
+        this->pool = 2;
+        this->relu = 1;
+        this->post = 1;
+        this->pad = 0;
+        this->dilation = 1;
+        this->stride = 1;
+        this->N = 2;
+        this->K = 2;
         this->mem_output_addr = 10000;
         this->mem_input_addr = 10000;
         this->S = 5;
@@ -31,6 +50,25 @@ public:
 
     conf_info_t(
         /* <<--ctor-args-->> */
+        int32_t W, 
+        int32_t H, 
+        int32_t frac_bits, 
+        int32_t coalesce, 
+        int32_t block_rows, 
+        int32_t stream, 
+        int32_t sparse, 
+        int32_t winograd, 
+        int32_t groups, 
+        int32_t pool_avg, 
+        int32_t pool_stride, 
+        int32_t pool, 
+        int32_t relu, 
+        int32_t post, 
+        int32_t pad, 
+        int32_t dilation, 
+        int32_t stride, 
+        int32_t N, 
+        int32_t K, 
         int32_t mem_output_addr, 
         int32_t mem_input_addr, 
         int32_t S, 
@@ -42,6 +80,25 @@ public:
         )
     {
         /* <<--ctor-custom-->> */
+        this->W = W;
+        this->H = H;
+        this->frac_bits = frac_bits;
+        this->coalesce = coalesce;
+        this->block_rows = block_rows;
+        this->stream = stream;
+        this->sparse = sparse;
+        this->winograd = winograd;
+        this->groups = groups;
+        this->pool_avg = pool_avg;
+        this->pool_stride = pool_stride;
+        this->pool = pool;
+        this->relu = relu;
+        this->post = post;
+        this->pad = pad;
+        this->dilation = dilation;
+        this->stride = stride;
+        this->N = N;
+        this->K = K;
         this->mem_output_addr = mem_output_addr;
         this->mem_input_addr = mem_input_addr;
         this->S = S;
@@ -56,6 +113,25 @@ public:
     inline bool operator==(const conf_info_t &rhs) const
     {
         /* <<--eq-->> */
+        if (W != rhs.W) return false;
+        if (H != rhs.H) return false;
+        if (frac_bits != rhs.frac_bits) return false;
+        if (coalesce != rhs.coalesce) return false;
+        if (block_rows != rhs.block_rows) return false;
+        if (stream != rhs.stream) return false;
+        if (sparse != rhs.sparse) return false;
+        if (winograd != rhs.winograd) return false;
+        if (groups != rhs.groups) return false;
+        if (pool_avg != rhs.pool_avg) return false;
+        if (pool_stride != rhs.pool_stride) return false;
+        if (pool != rhs.pool) return false;
+        if (relu != rhs.relu) return false;
+        if (post != rhs.post) return false;
+        if (pad != rhs.pad) return false;
+        if (dilation != rhs.dilation) return false;
+        if (stride != rhs.stride) return false;
+        if (N != rhs.N) return false;
+        if (K != rhs.K) return false;
         if (mem_output_addr != rhs.mem_output_addr) return false;
         if (mem_input_addr != rhs.mem_input_addr) return false;
         if (S != rhs.S) return false;
@@ -71,6 +147,25 @@ public:
     inline conf_info_t& operator=(const conf_info_t& other)
     {
         /* <<--assign-->> */
+        W = other.W;
+        H = other.H;
+        frac_bits = other.frac_bits;
+        coalesce = other.coalesce;
+        block_rows = other.block_rows;
+        stream = other.stream;
+        sparse = other.sparse;
+        winograd = other.winograd;
+        groups = other.groups;
+        pool_avg = other.pool_avg;
+        pool_stride = other.pool_stride;
+        pool = other.pool;
+        relu = other.relu;
+        post = other.post;
+        pad = other.pad;
+        dilation = other.dilation;
+        stride = other.stride;
+        N = other.N;
+        K = other.K;
         mem_output_addr = other.mem_output_addr;
         mem_input_addr = other.mem_input_addr;
         S = other.S;
@@ -91,6 +186,25 @@ public:
     {
         os << "{";
         /* <<--print-->> */
+        os << "W = " << conf_info.W << ", ";
+        os << "H = " << conf_info.H << ", ";
+        os << "frac_bits = " << conf_info.frac_bits << ", ";
+        os << "coalesce = " << conf_info.coalesce << ", ";
+        os << "block_rows = " << conf_info.block_rows << ", ";
+        os << "stream = " << conf_info.stream << ", ";
+        os << "sparse = " << conf_info.sparse << ", ";
+        os << "winograd = " << conf_info.winograd << ", ";
+        os << "groups = " << conf_info.groups << ", ";
+        os << "pool_avg = " << conf_info.pool_avg << ", ";
+        os << "pool_stride = " << conf_info.pool_stride << ", ";
+        os << "pool = " << conf_info.pool << ", ";
+        os << "relu = " << conf_info.relu << ", ";
+        os << "post = " << conf_info.post << ", ";
+        os << "pad = " << conf_info.pad << ", ";
+        os << "dilation = " << conf_info.dilation << ", ";
+        os << "stride = " << conf_info.stride << ", ";
+        os << "N = " << conf_info.N << ", ";
+        os << "K = " << conf_info.K << ", ";
         os << "mem_output_addr = " << conf_info.mem_output_addr << ", ";
         os << "mem_input_addr = " << conf_info.mem_input_addr << ", ";
         os << "S = " << conf_info.S << ", ";
@@ -104,6 +218,25 @@ public:
     }
 
         /* <<--params-->> */
+        int32_t W;
+        int32_t H;
+        int32_t frac_bits;
+        int32_t coalesce;
+        int32_t block_rows;
+        int32_t stream;
+        int32_t sparse;
+        int32_t winograd;
+        int32_t groups;
+        int32_t pool_avg;
+        int32_t pool_stride;
+        int32_t pool;
+        int32_t relu;
+        int32_t post;
+        int32_t pad;
+        int32_t dilation;
+        int32_t stride;
+        int32_t N;
+        int32_t K;
         int32_t mem_output_addr;
         int32_t mem_input_addr;
         int32_t S;
@@ -4,20 +4,121 @@
 #ifndef __CONV_DIRECTIVES_HPP__
 #define __CONV_DIRECTIVES_HPP__
 
+// Element width of activations and weights: 8, 16 or 32 bits
+#ifndef DATA_WIDTH
+#define DATA_WIDTH 32
+#endif
+
+#if (DATA_WIDTH == 8)
+#define DMA_SIZE SIZE_BYTE
+#define PLM_DATA_TAG "_int8"
+#elif (DATA_WIDTH == 16)
+#define DMA_SIZE SIZE_HWORD
+#define PLM_DATA_TAG "_int16"
+#elif (DATA_WIDTH == 32)
+#define DMA_SIZE SIZE_WORD
+#define PLM_DATA_TAG ""
+#else
+#error Unsupported DATA_WIDTH
+#endif
+
+// Elements are packed in DMA beats: DMA_WORD_PER_BEAT per beat of the
+// 32, 64, 128 or 256-bit NoC link
 #if (DMA_WIDTH == 32)
-#define DMA_BEAT_PER_WORD 1
-#define DMA_WORD_PER_BEAT 1
-#define PLM_WEIGHT_NAME "conv_plm_block_weight_dma32"
-#define PLM_IN_NAME "conv_plm_block_in_dma32"
-#define PLM_OUT_NAME "conv_plm_block_out_dma32"
+#define PLM_DMA_TAG "_dma32"
 #elif (DMA_WIDTH == 64)
-#define DMA_BEAT_PER_WORD 1
-#define DMA_WORD_PER_BEAT 2
-#define PLM_WEIGHT_NAME "conv_plm_block_weight_dma64"
-#define PLM_IN_NAME "conv_plm_block_in_dma64"
-#define PLM_OUT_NAME "conv_plm_block_out_dma64"
+#define PLM_DMA_TAG "_dma64"
+#elif (DMA_WIDTH == 128)
+#define PLM_DMA_TAG "_dma128"
+#elif (DMA_WIDTH == 256)
+#define PLM_DMA_TAG "_dma256"
+#else
+#error Unsupported DMA_WIDTH
+#endif
+
+// Weight buffers between load and compute: 2 (ping/pong), 3 or 4 let load
+// run further ahead and absorb the latency jitter of the weight DMA. Layers
+// with no more filter passes than buffers, and unchunked channels, load
+// their weights once instead of once per row band
+#ifndef WEIGHT_BUFFERS
+#define WEIGHT_BUFFERS 2
+#endif
+
+#if (WEIGHT_BUFFERS == 2)
+#define HLS_BREAK_DEP_WEIGHT HLS_BREAK_DEP(plm_weight_0); HLS_BREAK_DEP(plm_weight_1)
+#elif (WEIGHT_BUFFERS == 3)
+#define HLS_BREAK_DEP_WEIGHT HLS_BREAK_DEP(plm_weight_0); HLS_BREAK_DEP(plm_weight_1); \
+    HLS_BREAK_DEP(plm_weight_2)
+#elif (WEIGHT_BUFFERS == 4)
+#define HLS_BREAK_DEP_WEIGHT HLS_BREAK_DEP(plm_weight_0); HLS_BREAK_DEP(plm_weight_1); \
+    HLS_BREAK_DEP(plm_weight_2); HLS_BREAK_DEP(plm_weight_3)
+#else
+#error Unsupported WEIGHT_BUFFERS
+#endif
+
+// Accumulator width of the MACs and of the partial sums in plm_out: 64 sums
+// deep layers without wrapping and saturates the finished outputs to
+// DATA_WIDTH bits, 32 is the narrower datapath. Qm.n partial sums carry 2n fraction bits until
+// the output is finished, they must fit in SUM_WIDTH bits.
+#ifndef SUM_WIDTH
+#define SUM_WIDTH 64
 #endif
 
+#if (SUM_WIDTH != 32 && SUM_WIDTH != 64)
+#error Unsupported SUM_WIDTH
+#endif
+
+// Single-precision datapath: -DDATA_FP32 multiplies and accumulates the
+// 32-bit words as IEEE-754 floats; the integer one reads them as Qm.n
+// fixed point with the fraction bits of the frac_bits register
+#if defined(DATA_FP32) && (DATA_WIDTH != 32)
+#error DATA_FP32 needs DATA_WIDTH 32
+#endif
+
+// plm_out words are 64 bits wide, or 32 bits (the _acc32 memories) with
+// 32-bit sums and in fp32
+#if (SUM_WIDTH == 32) || defined(DATA_FP32)
+#define PLM_ACC_TAG "_acc32"
+#else
+#define PLM_ACC_TAG ""
+#endif
+
+// PLM profile: sizes of the private memories in 32-bit words (plm_out in
+// accumulator words) and banks of plm_in. 1 is the original sizing, 0 a
+// small-area variant for edge tiles and 2 a large variant for bigger layers.
+// The same limits are exported to software in conv_stratus.h.
+#ifndef PLM_PROFILE
+#define PLM_PROFILE 1
+#endif
+
+#if (PLM_PROFILE == 0)
+#define PLM_IN_SIZE 1600
+#define PLM_WEIGHT_SIZE 600
+#define PLM_OUT_SIZE 600
+#define PLM_IN_BANKS 8
+#define PLM_SIZE_TAG "_small"
+#elif (PLM_PROFILE == 1)
+#define PLM_IN_SIZE 4000
+#define PLM_WEIGHT_SIZE 1200
+#define PLM_OUT_SIZE 1200
+#define PLM_IN_BANKS 8
+#define PLM_SIZE_TAG ""
+#elif (PLM_PROFILE == 2)
+#define PLM_IN_SIZE 16000
+#define PLM_WEIGHT_SIZE 4800
+#define PLM_OUT_SIZE 4800
+#define PLM_IN_BANKS 8
+#define PLM_SIZE_TAG "_large"
+#else
+#error Unsupported PLM_PROFILE
+#endif
+
+#define DMA_BEAT_PER_WORD 1
+#define DMA_WORD_PER_BEAT (DMA_WIDTH / DATA_WIDTH)
+#define PLM_WEIGHT_NAME "conv_plm_block_weight" PLM_SIZE_TAG PLM_DATA_TAG PLM_DMA_TAG
+#define PLM_IN_NAME "conv_plm_block_in" PLM_SIZE_TAG PLM_DATA_TAG PLM_DMA_TAG
+#define PLM_OUT_NAME "conv_plm_block_out" PLM_SIZE_TAG PLM_ACC_TAG PLM_DATA_TAG PLM_DMA_TAG
+
 
 #if defined(STRATUS_HLS)
 
@@ -36,6 +137,9 @@
 #define HLS_UNROLL_SIMPLE                       \
     HLS_UNROLL_LOOP(ON)
 
+#define HLS_PIPE(_s)                            \
+    HLS_PIPELINE_LOOP(HARD_STALL, 1, _s)
+
 #if defined(HLS_DIRECTIVES_BASIC)
 
 #else
@@ -51,6 +155,7 @@
 #define HLS_FLAT(_a)
 #define HLS_BREAK_DEP(_a)
 #define HLS_UNROLL_SIMPLE
+#define HLS_PIPE(_s)
 
 #endif /* STRATUS_HLS */
 
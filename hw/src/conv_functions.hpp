@@ -4,3 +4,444 @@
 #include "conv.hpp"
 
 // Optional application-specific helper functions
+
+// Load waits for compute to be done with the weight set WEIGHT_BUFFERS back
+inline void conv::load_weight_wait(uint32_t sets)
+{
+    {
+        HLS_PROTO("load-weight-wait");
+        while (sets >= weight_sets_done.read() + WEIGHT_BUFFERS)
+            wait();
+    }
+}
+
+// Load waits for compute to be done with the input two refills back
+inline void conv::load_input_wait(uint32_t loads)
+{
+    {
+        HLS_PROTO("load-input-wait");
+        while (loads >= in_released.read() + 2)
+            wait();
+    }
+}
+
+// Load has the weights and input of `steps` passes in
+inline void conv::load_step_done(uint32_t steps)
+{
+    {
+        HLS_PROTO("load-step-done");
+        load_steps.write(steps);
+        wait();
+    }
+}
+
+// Compute waits for the weights and input of its next pass, compute_counter
+// counts the stall
+inline void conv::compute_step_wait(uint32_t steps)
+{
+    {
+        HLS_PROTO("compute-step-wait");
+        compute_stall.write(true);
+        while (load_steps.read() == steps)
+            wait();
+        compute_stall.write(false);
+    }
+}
+
+// Weight buffer `slot` of the circular queue
+inline sc_dt::sc_int<DATA_WIDTH> conv::weight_read(uint32_t slot, uint32_t index)
+{
+#if (WEIGHT_BUFFERS > 3)
+    if (slot == 3)
+        return plm_weight_3[index];
+#endif
+#if (WEIGHT_BUFFERS > 2)
+    if (slot == 2)
+        return plm_weight_2[index];
+#endif
+    if (slot == 1)
+        return plm_weight_1[index];
+
+    return plm_weight_0[index];
+}
+
+inline void conv::weight_write(uint32_t slot, uint32_t index, sc_dt::sc_int<DATA_WIDTH> data)
+{
+#if (WEIGHT_BUFFERS > 3)
+    if (slot == 3)
+        plm_weight_3[index] = data;
+#endif
+#if (WEIGHT_BUFFERS > 2)
+    if (slot == 2)
+        plm_weight_2[index] = data;
+#endif
+    if (slot == 1)
+        plm_weight_1[index] = data;
+    if (slot == 0)
+        plm_weight_0[index] = data;
+}
+
+// Specialized kernels: CONV_R and CONV_S fix the kernel geometry at compile
+// time, so HLS sizes the MAC array and unrolls with constant bounds.
+// Undefined, they are read from the configuration at run time. Average
+// pools divide by shifting, so their window side is a power of two. Returns
+// false for a layer the accelerator is not specialized for, and leaves its
+// configuration unchanged so the counters and status still follow its output.
+inline bool conv::specialize(conf_info_t &config)
+{
+    bool match = !config.pool_avg || (config.pool & (config.pool - 1)) == 0;
+
+#ifdef CONV_R
+    match = match && (config.R == CONV_R);
+#endif
+#ifdef CONV_S
+    match = match && (config.S == CONV_S);
+#endif
+    if (!match)
+        return false;
+
+#ifdef CONV_R
+    config.R = CONV_R;
+#endif
+#ifdef CONV_S
+    config.S = CONV_S;
+#endif
+
+    return true;
+}
+
+// Input rows (or columns) read by `out` output rows (or columns)
+inline int32_t conv::in_span(int32_t out, int32_t kernel, int32_t stride, int32_t dilation)
+{
+    return (out - 1) * stride + (kernel - 1) * dilation + 1;
+}
+
+// Input rows (or columns) in memory: the H (W) register, or when 0 those
+// read by the outputs less a symmetric pad
+inline int32_t conv::in_extent(int32_t size, int32_t out, int32_t kernel, int32_t stride, int32_t dilation, int32_t pad)
+{
+    return (size > 0) ? size : in_span(out, kernel, stride, dilation) - 2 * pad;
+}
+
+// Rows of plm_in taken by `rows` input rows of a channel. Rows are stored
+// grouped by phase modulo the dilation, so the R rows of a dilated kernel
+// sit in consecutive slots; every phase gets the same number of slots.
+inline int32_t conv::in_slots(int32_t rows, int32_t dilation)
+{
+    return (rows + dilation - 1) / dilation * dilation;
+}
+
+// Row pitch of plm_in. A pitch congruent to 1 modulo PLM_IN_BANKS maps
+// the same column of KERNEL_MAX consecutive slots to distinct cyclic banks,
+// so the sliding window shifts in a whole column in one cycle.
+inline int32_t conv::in_pitch(int32_t width)
+{
+    return width + (1 + PLM_IN_BANKS - width % PLM_IN_BANKS) % PLM_IN_BANKS;
+}
+
+// Kernel columns per sub-kernel: the dilated sub-kernel must fit in the
+// columns of the sliding window.
+inline int32_t conv::window_cols(int32_t dilation)
+{
+    int32_t cols = (WINDOW_MAX - 1) / dilation + 1;
+
+    return (cols > MAC_COLS) ? MAC_COLS : cols;
+}
+
+// Output rows that make a band store a whole number of DMA beats
+inline int32_t conv::band_align(int32_t Q)
+{
+    int32_t q_align = Q & -Q;
+
+    if (q_align >= DMA_WORD_PER_BEAT)
+        return 1;
+
+    return DMA_WORD_PER_BEAT / q_align;
+}
+
+// Outputs left by a pooling window sliding over `size` conv outputs
+inline int32_t conv::pooled(int32_t size, int32_t pool, int32_t pool_stride)
+{
+    return (size - pool) / pool_stride + 1;
+}
+
+// The Winograd F(2x2,3x3) engine takes the 3x3 stride-1 undilated layers,
+// the other layers run on the direct engine whatever the winograd field
+inline bool conv::winograd_mode(const conf_info_t &config)
+{
+#if defined(DATA_FP32)
+    // The Winograd engine runs on integer sums scaled by 4
+    return false;
+#else
+    return config.winograd && !config.sparse && config.R == 3 && config.S == 3 &&
+        config.stride == 1 && config.dilation == 1;
+#endif
+}
+
+// Weights per filter and channel: the R x S kernel, or its WINO_TILE x WINO_TILE
+// transform (2G) g (2G)^T precomputed by the host for the Winograd engine.
+// A sparse kernel takes its nonzero count and up to R x S (tap, value) entries.
+inline int32_t conv::kernel_words(const conf_info_t &config)
+{
+    if (config.sparse)
+        return 1 + 2 * config.R * config.S;
+
+    return winograd_mode(config) ? WINO_TILE * WINO_TILE : config.R * config.S;
+}
+
+// Memory words between two filters. Input rows, filters, the post-processing
+// parameters and output planes all start on a DMA beat; a sparse filter is its
+// C / groups counts, then room for C / groups x R x S (tap, value) entries.
+inline int32_t conv::filter_words(const conf_info_t &config)
+{
+    int32_t Cg = config.C / config.groups;
+
+    if (config.sparse)
+        return round_up(Cg, DMA_WORD_PER_BEAT) + round_up(Cg * config.R * config.S * 2, DMA_WORD_PER_BEAT);
+
+    return round_up(Cg * kernel_words(config), DMA_WORD_PER_BEAT);
+}
+
+// 1x1 layers are a GEMM over the channels: plm_in holds the chunk
+// channel-contiguous, plm_in[(row * in_width + col) * channels + c]
+inline bool conv::pointwise_mode(const conf_info_t &config)
+{
+    return config.R == 1 && config.S == 1 && !config.sparse;
+}
+
+// Input channels per chunk, out of the C / groups channels of a conv
+// group: the chunk weights and post-processing parameters of K filters
+// must fit in plm_weight and the smallest band of the chunk must fit in
+// plm_in. Partial sums of the chunks accumulate in plm_out.
+inline int32_t conv::chunk_channels(const conf_info_t &config)
+{
+    int32_t out_width = pooled(config.Q, config.pool, config.pool_stride);
+    int32_t conv_rows = in_span(band_align(out_width), config.pool, config.pool_stride, 1);
+    int32_t in_rows = in_span(conv_rows, config.R, config.stride, config.dilation);
+    int32_t pitch = in_pitch(in_span(config.Q, config.S, config.stride, config.dilation));
+    int32_t band_min = in_slots(in_rows, config.dilation) * pitch;
+    int32_t channels = (PLM_WEIGHT_WORD / config.K - POST_PARAMS) / kernel_words(config);
+
+    if (channels > PLM_IN_WORD / band_min)
+        channels = PLM_IN_WORD / band_min;
+
+    if (channels > config.C / config.groups)
+        channels = config.C / config.groups;
+
+    return channels;
+}
+
+// Output rows per band, after pooling: the band input (the rows read by
+// the conv rows of the band, for every channel of a chunk) must fit in
+// plm_in and the conv rows of K filters must fit in plm_out. A row block
+// caps the band, and with it the plm_out rows in use. No band fits the
+// PLM profile when it returns 0.
+inline int32_t conv::band_rows(const conf_info_t &config, int32_t chunk)
+{
+    int32_t R = config.R;
+    int32_t Q = config.Q;
+    int32_t dilation = config.dilation;
+    int32_t out_height = pooled(config.P, config.pool, config.pool_stride);
+    int32_t out_width = pooled(Q, config.pool, config.pool_stride);
+
+    if (chunk == 0)
+        return 0;
+
+    int32_t slots = PLM_IN_WORD / (chunk * in_pitch(in_span(Q, config.S, config.stride, dilation)));
+
+    // Largest conv band whose input rows, rounded up to whole phases, fit in slots
+    int32_t conv_rows = (slots / dilation * dilation - (R - 1) * dilation - 1) / config.stride + 1;
+
+    if (conv_rows > PLM_OUT_WORD / (config.K * Q))
+        conv_rows = PLM_OUT_WORD / (config.K * Q);
+
+    int32_t rows = pooled(conv_rows, config.pool, config.pool_stride);
+    int32_t align = band_align(out_width);
+
+    // Row blocks: bands of at most block_rows output rows, rounded up to whole
+    // DMA beats, so every block is stored while the next one computes. Blocks
+    // are bands: each loads its input rows with the kernel halo, and the
+    // weights unless they are resident. plm_out keeps its size.
+    int32_t block = (config.block_rows + align - 1) / align * align;
+
+    if (block > 0 && rows > block)
+        rows = block;
+
+    if (rows >= out_height)
+        return out_height;
+
+    return rows - rows % align;
+}
+
+// Output rows of the first band. Row streaming starts on the smallest band
+// that stores whole DMA beats, so compute waits for a few input rows only.
+inline int32_t conv::first_band(const conf_info_t &config, int32_t rows)
+{
+    int32_t align = band_align(pooled(config.Q, config.pool, config.pool_stride));
+
+    return (config.stream && align < rows) ? align : rows;
+}
+
+// Streaming bands double up to `rows`: each band loads while the previous
+// one computes. Every band loads all of its input rows, the kernel halo
+// included, and the weights unless they are resident.
+inline int32_t conv::next_band(int32_t band, int32_t rows)
+{
+    return (2 * band < rows) ? 2 * band : rows;
+}
+
+// Filters per pass: K, or fewer when the conv rows of K filters in plm_out
+// cannot cover a band of output rows stored in whole DMA beats. A Winograd
+// iteration writes two outputs of each filter, so it takes half as many.
+inline int32_t conv::pass_filters(const conf_info_t &config)
+{
+    conf_info_t pass = config;
+
+    if (winograd_mode(pass) && pass.K > FILTERS_MAX / 2)
+        pass.K = FILTERS_MAX / 2;
+
+    while (pass.K > 1 && band_rows(pass, chunk_channels(pass)) == 0)
+        pass.K--;
+
+    return pass.K;
+}
+
+// Weights resident across the bands: with a single chunk per conv group
+// and no more filter passes than weight buffers, the first band loads every
+// pass into its own buffer and the others reuse them. Otherwise each band
+// reloads the weights of all its passes.
+inline bool conv::weights_resident(const conf_info_t &config, int32_t chunk)
+{
+    int32_t Mg = config.M / config.groups;
+    int32_t passes = config.groups * ((Mg + config.K - 1) / config.K);
+
+    return chunk == config.C / config.groups && passes <= WEIGHT_BUFFERS;
+}
+
+// fp32 words are IEEE-754 bit patterns
+inline float conv::to_float(sc_dt::sc_int<32> word)
+{
+    union { uint32_t bits; float x; } u;
+
+    u.bits = word.to_uint();
+    return u.x;
+}
+
+inline sc_dt::sc_int<32> conv::from_float(float x)
+{
+    union { uint32_t bits; float x; } u;
+
+    u.x = x;
+    return (int32_t) u.bits;
+}
+
+// Product of an input and a weight in the accumulator type
+inline sum_t conv::product(sc_dt::sc_int<DATA_WIDTH> a, sc_dt::sc_int<DATA_WIDTH> b)
+{
+#if defined(DATA_FP32)
+    return to_float(a) * to_float(b);
+#else
+    return (sum_t) a * b;
+#endif
+}
+
+// Partial sum held in a plm_out word, and back
+inline sum_t conv::to_sum(sc_dt::sc_int<ACC_WIDTH> word)
+{
+#if defined(DATA_FP32)
+    return to_float(word);
+#else
+    return word;
+#endif
+}
+
+inline sc_dt::sc_int<ACC_WIDTH> conv::to_word(sum_t acc)
+{
+#if defined(DATA_FP32)
+    return from_float(acc);
+#else
+    return acc;
+#endif
+}
+
+// Average of a pool window of 2^shift outputs: the sum shifted right and
+// rounded toward zero, as a division would, or scaled by 2^-shift in fp32
+inline sum_t conv::pool_average(sum_t sum, int32_t shift)
+{
+#if defined(DATA_FP32)
+    return sum * to_float((127 - shift) << 23);
+#else
+    sum_t round = (sum < 0) ? (sum_t) ((1 << shift) - 1) : (sum_t) 0;
+    return (sum + round) >> shift;
+#endif
+}
+
+// Bias, requantization and ReLU of a finished output:
+// ((acc + bias) * scale + round) >> shift, saturated to DATA_WIDTH bits.
+// Qm.n sums carry 2n fraction bits and are rounded back to n first. In fp32
+// the output is (acc + bias) * scale, shift is unused.
+inline sum_t conv::post_process(sum_t acc, bool post, bool relu,
+                                sc_dt::sc_int<DATA_WIDTH> bias,
+                                sc_dt::sc_int<DATA_WIDTH> scale,
+                                sc_dt::sc_int<DATA_WIDTH> shift,
+                                int32_t frac_bits)
+{
+#if defined(DATA_FP32)
+    float x = acc;
+
+    if (post)
+        x = (x + to_float(bias)) * to_float(scale);
+#else
+    const int64_t max = ((int64_t) 1 << (DATA_WIDTH - 1)) - 1;
+    const int64_t min = -max - 1;
+    sc_dt::sc_int<64> x = acc;
+
+    if (frac_bits > 0)
+        x = (x + ((sc_dt::sc_int<64>) 1 << (frac_bits - 1))) >> frac_bits;
+
+    if (post) {
+        x = (x + bias) * scale;
+        if (shift > 0)
+            x = (x + ((sc_dt::sc_int<64>) 1 << (shift - 1))) >> shift;
+
+        if (x > max)
+            x = max;
+        else if (x < min)
+            x = min;
+    }
+#endif
+
+    if (relu && x < 0)
+        x = 0;
+
+    return x;
+}
+
+// Writeback of a finished output into plm_out, saturated to DATA_WIDTH
+// bits so that the store packs it without wrapping. fp32 outputs do not
+// saturate, infinities and NaNs raise the flag instead.
+inline sc_dt::sc_int<ACC_WIDTH> conv::saturate(sum_t acc, bool &overflow)
+{
+#if defined(DATA_FP32)
+    if (!(acc - acc == 0))
+        overflow = true;
+
+    return to_word(acc);
+#else
+    const int64_t max = ((int64_t) 1 << (DATA_WIDTH - 1)) - 1;
+    const int64_t min = -max - 1;
+
+#if (SUM_WIDTH > DATA_WIDTH)
+    if (acc > max) {
+        overflow = true;
+        return max;
+    }
+    if (acc < min) {
+        overflow = true;
+        return min;
+    }
+#endif
+
+    return acc;
+#endif
+}
@@ -2,8 +2,71 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
 #include "system.hpp"
 
+#if defined(DATA_FP32)
+static const bool data_fp32 = true;
+#else
+static const bool data_fp32 = false;
+#endif
+
+// fp32 words are IEEE-754 bit patterns
+static float word_float(int32_t word)
+{
+    float x;
+    memcpy(&x, &word, sizeof(x));
+    return x;
+}
+
+static int32_t float_word(float x)
+{
+    int32_t word;
+    memcpy(&word, &x, sizeof(word));
+    return word;
+}
+
+// Random integer in [-range, range), or in fp32 a float in [-1, 1)
+static int32_t random_word(int range)
+{
+    int x = rand()%(2*range)-range;
+    return data_fp32 ? float_word((float) x / range) : x;
+}
+
+// Sets the layer parameter of a name=value argument
+bool system_t::set_param(const char *arg)
+{
+    const struct { const char *name; int32_t *param; } params[] = {
+        {"C", &C}, {"M", &M}, {"P", &P}, {"Q", &Q}, {"R", &R}, {"S", &S},
+        {"K", &K}, {"N", &N}, {"stride", &stride}, {"dilation", &dilation},
+        {"pad", &pad}, {"post", &post}, {"relu", &relu}, {"pool", &pool},
+        {"pool_stride", &pool_stride}, {"pool_avg", &pool_avg},
+        {"groups", &groups}, {"winograd", &winograd}, {"sparse", &sparse},
+        {"stream", &stream}, {"block_rows", &block_rows},
+        {"coalesce", &coalesce}, {"frac_bits", &frac_bits},
+        {"H", &H}, {"W", &W},
+        {"data_range", &data_range},
+    };
+    const char *value = strchr(arg, '=');
+
+    if (value == NULL)
+        return false;
+
+    for (size_t i = 0; i < sizeof(params) / sizeof(params[0]); i++)
+    {
+        if (strlen(params[i].name) == (size_t) (value - arg) &&
+            strncmp(params[i].name, arg, value - arg) == 0)
+        {
+            *params[i].param = atoi(value + 1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
 // Process
 void system_t::config_proc()
 {
@@ -23,6 +86,25 @@ void system_t::config_proc()
         conf_info_t config;
         // Custom configuration
         /* <<--params-->> */
+        config.W = W;
+        config.H = H;
+        config.frac_bits = frac_bits;
+        config.coalesce = coalesce;
+        config.block_rows = block_rows;
+        config.stream = stream;
+        config.sparse = sparse;
+        config.winograd = winograd;
+        config.groups = groups;
+        config.pool_avg = pool_avg;
+        config.pool_stride = pool_stride;
+        config.pool = pool;
+        config.relu = relu;
+        config.post = post;
+        config.pad = pad;
+        config.dilation = dilation;
+        config.stride = stride;
+        config.N = N;
+        config.K = K;
         config.mem_output_addr = mem_output_addr;
         config.mem_input_addr = mem_input_addr;
         config.S = S;
@@ -78,80 +160,254 @@ void system_t::config_proc()
 // Functions
 void system_t::load_memory()
 {
-    // Optional usage check
+    // Optional layer parameters, as name=value arguments
 #ifdef CADENCE
-    if (esc_argc() != 1)
+    for (int i = 1; i < esc_argc(); i++)
     {
-        ESP_REPORT_INFO("usage: %s\n", esc_argv()[0]);
-        sc_stop();
+        if (!set_param(esc_argv()[i]))
+        {
+            ESP_REPORT_INFO("usage: %s [name=value ...]\n", esc_argv()[0]);
+            sc_stop();
+        }
     }
 #endif
 
-    // Input data and golden output (aligned to DMA_WIDTH makes your life easier)
+    // Input height and width in memory: H and W, or when 0 the rows and
+    // columns read by the P x Q outputs without the pad
+    int in_h = H ? H : (P - 1) * stride + (R - 1) * dilation + 1 - 2 * pad;
+    int in_w = W ? W : (Q - 1) * stride + (S - 1) * dilation + 1 - 2 * pad;
+
+    // Output height and width after pooling
+    int out_h = (P - pool) / pool_stride + 1;
+    int out_w = (Q - pool) / pool_stride + 1;
+
+    // The accelerator runs 3x3 stride-1 layers on the Winograd engine if asked,
+    // and then reads 4x4 transformed kernels. Sparse kernels take a nonzero
+    // count and room for R x S (tap, value) entries.
+    bool wino = !data_fp32 && winograd && !sparse && R == 3 && S == 3 && stride == 1 && dilation == 1;
+    int taps = sparse ? 1 + 2 * R * S : wino ? 16 : R * S;
+
+    // Aligned layout: input rows, filters, the post-processing parameters and
+    // output planes start on a DMA beat, the padding words are zeros
 #if (DMA_WORD_PER_BEAT == 0)
-    in_words_adj = C*(P+R-1)*(Q+S-1)+M*C*R*S;
-    out_words_adj = M*P*Q;
+    int in_row = in_w;
+    int filter_words = sparse ? (C/groups) + (C/groups)*R*S*2 : (C/groups)*taps;
+    int post_words = 3*M;
+    out_plane = out_h*out_w;
 #else
-    in_words_adj = round_up(C*(P+R-1)*(Q+S-1)+M*C*R*S, DMA_WORD_PER_BEAT);
-    out_words_adj = round_up(M*P*Q, DMA_WORD_PER_BEAT);
+    int in_row = round_up(in_w, DMA_WORD_PER_BEAT);
+    int filter_words = sparse ? round_up(C/groups, DMA_WORD_PER_BEAT) + round_up((C/groups)*R*S*2, DMA_WORD_PER_BEAT)
+                              : round_up((C/groups)*taps, DMA_WORD_PER_BEAT);
+    int post_words = round_up(3*M, DMA_WORD_PER_BEAT);
+    out_plane = round_up(out_h*out_w, DMA_WORD_PER_BEAT);
+#endif
+    in_words_adj = N*C*in_h*in_row+M*filter_words+(post ? post_words : 0);
+    out_words_adj = M*out_plane;
     //printf("in_words_adj:%d\n", in_words_adj);
     //printf("out_words_adj:%d\n", out_words_adj);
-#endif
 
     in_size = in_words_adj * (1);
-    out_size = out_words_adj * (1);
+    out_size = out_words_adj * (N);
 
-    in = new int32_t[in_size ];
-    int weight_base = C * (P + R - 1) * (Q + S - 1);
+    // The input, the output and the counters and status after it must fit
+    // the MEM_SIZE beats of the simulated memory
+#if (DMA_WORD_PER_BEAT == 0)
+    size_t beats = (size_t) (in_size + out_size) * DMA_BEAT_PER_WORD + 3 + 4*M;
+#else
+    size_t beats = (size_t) (in_size + out_size) / DMA_WORD_PER_BEAT + 3 + 4*M;
+#endif
+    if (beats > MEM_SIZE)
+    {
+        ESP_REPORT_ERROR("the layer takes %zu memory beats, more than MEM_SIZE (%zu)", beats, MEM_SIZE);
+        sc_stop();
+        return;
+    }
+
+    in = new int32_t[in_size]();
 
     int num = 0;
     int index = 0;
+
+    // Random elements fit in DATA_WIDTH bits. data_range widens them up to
+    // the full range to reach the saturation of the outputs, Qm.n elements
+    // are in [-1, 1) by default.
+    int range = (DATA_WIDTH == 8) ? 128 : 500;
+    if (data_range > 0)
+        range = data_range;
+    else if (frac_bits > 0 && !data_fp32)
+        range = 1 << frac_bits;
+    if (DATA_WIDTH < 32 && range > (1 << (DATA_WIDTH - 1)))
+        range = 1 << (DATA_WIDTH - 1);
     // input
-    for (int c = 0 ; c < C ; c++){
-        for(int j = 0 ; j < (P + R - 1) ; j++){
-            for(int k = 0 ; k < (Q + S - 1) ; k++){
-                in[index++] = rand()%1000-500; // range from -50 ~ 49
-                //in[index++] = num++; // range from -50 ~ 49
+    for (int n = 0 ; n < N ; n++){
+        for (int c = 0 ; c < C ; c++){
+            for(int j = 0 ; j < in_h ; j++){
+                for(int k = 0 ; k < in_w ; k++){
+                    in[(n*C + c)*in_h*in_row + j*in_row + k] = random_word(range);
+                    //in[index++] = num++; // range from -50 ~ 49
+                }
             }
         }
     }
-    
+    int weight_base = N*C*in_h*in_row;
+
     // weight
-    
+    // Transformed weights (2G) g (2G)^T grow up to 9x and must fit in DATA_WIDTH bits
+    int weight_range = (wino && DATA_WIDTH < 32 && 9 * range >= (1 << (DATA_WIDTH - 1))) ? range / 9 : range;
+    int32_t *weight = new int32_t[M * (C / groups) * R * S];
+    const int G[4][3] = {{2, 0, 0}, {1, 1, 1}, {1, -1, 1}, {0, 0, 2}};
+
+    // Sparse kernels: about 70% zeros; a filter holds the counts of its
+    // channels, then their (tap, value) entries
     for (int m = 0 ; m < M ; m++){
         //num = 0;
-        for (int c = 0 ; c < C ; c++){
+        index = weight_base + m*filter_words;
+        int entry = index + round_up(C/groups, DMA_WORD_PER_BEAT);
+        for (int c = 0 ; c < C / groups ; c++){
+            int32_t *g = &weight[(m*(C/groups) + c)*R*S];
+            int nnz = 0;
             for (int r = 0 ; r < R ; r++){
                 for (int s = 0 ; s < S ; s++){
-                    in[index++] = rand()%1000-500; // range from -500 ~ 499
-                    //printf("weight[%d]:%d\n", index-1-weight_base, in[index-1]);
+                    g[r*S + s] = random_word(weight_range);
+                    if (sparse && rand() % 10 < 7)
+                        g[r*S + s] = 0;
+                    if (sparse && g[r*S + s] != 0) {
+                        in[entry++] = r*S + s;
+                        in[entry++] = g[r*S + s];
+                        nnz++;
+                    } else if (!sparse && !wino)
+                        in[index++] = g[r*S + s];
                     //in[index++] = (num++)%500; // range from -50 ~ 49
                 }
             }
+            if (sparse)
+                in[index++] = nnz;
+            if (wino){
+                for (int i = 0 ; i < 4 ; i++){
+                    for (int j = 0 ; j < 4 ; j++){
+                        int u = 0;
+                        for (int r = 0 ; r < 3 ; r++)
+                            for (int s = 0 ; s < 3 ; s++)
+                                u += G[i][r] * g[r*3 + s] * G[j][s];
+                        in[index++] = u;
+                    }
+                }
+            }
         }
     }
 
     gold = new int32_t[out_size];
-    for (int m = 0 ; m < M ; m++){
-        for (int p = 0 ; p < P ; p++){
-            for (int q = 0 ; q < Q ; q++){
-                int gold_index = m*P*Q + p*Q +q;
-                gold[gold_index] = 0;
-                for (int c = 0 ; c < C ; c++){
-                    for (int r = 0 ; r < R ; r++){
-                        for (int s = 0 ; s < S ; s++){
-                            int input_index = c*(P+R-1)*(Q+S-1) + (p+r)*(Q+S-1) + (q+s);
-                            int weight_index = weight_base + m*C*R*S + c*R*S + r*S + s;
-                            // if(m == 0 && p == 0){
-                            //     printf("acc[0][%d] += %d * %d\n",q, in[input_index], in[weight_index]);
-                            // }
-                            gold[gold_index] += in[input_index] * in[weight_index];
+    gold_overflow = false;
+    // bias, multiplier and shift of each filter
+    const int64_t data_max = ((int64_t) 1 << (DATA_WIDTH - 1)) - 1;
+    int post_base = weight_base + M*filter_words;
+    index = post_base;
+    if (post && data_fp32) {
+        for (int m = 0 ; m < M ; m++){
+            in[index++] = random_word(range);
+            in[index++] = float_word((rand()%16+1) / 8.0f);
+            in[index++] = 0;
+        }
+    } else if (post) {
+        for (int m = 0 ; m < M ; m++){
+            in[index++] = rand()%(2*range)-range;
+            in[index++] = rand()%16+1;
+            in[index++] = rand()%12;
+        }
+    }
+
+    for (int n = 0 ; n < N ; n++){
+        for (int m = 0 ; m < M ; m++){
+            for (int pp = 0 ; pp < out_h ; pp++){
+                for (int qq = 0 ; qq < out_w ; qq++){
+                    int gold_index = n*out_words_adj + m*out_plane + pp*out_w + qq;
+                    int64_t result = 0;
+                    float fresult = 0;
+
+                    // Pooling window of conv outputs (p, q)
+                    for (int a = 0 ; a < pool ; a++){
+                        for (int b = 0 ; b < pool ; b++){
+                            int p = pp*pool_stride + a;
+                            int q = qq*pool_stride + b;
+                            int64_t acc = 0;
+                            float facc = 0;
+                            for (int c = 0 ; c < C / groups ; c++){
+                                for (int r = 0 ; r < R ; r++){
+                                    for (int s = 0 ; s < S ; s++){
+                                        int y = p*stride + r*dilation - pad;
+                                        int x = q*stride + s*dilation - pad;
+                                        // Taps on the pad read zeros
+                                        if (y < 0 || y >= in_h || x < 0 || x >= in_w)
+                                            continue;
+                                        int input_index = (n*C + m/(M/groups)*(C/groups) + c)*in_h*in_row + y*in_row + x;
+                                        int weight_index = m*(C/groups)*R*S + c*R*S + r*S + s;
+                                        // if(m == 0 && p == 0){
+                                        //     printf("acc[0][%d] += %d * %d\n",q, in[input_index], weight[weight_index]);
+                                        // }
+                                        acc += (int64_t) in[input_index] * weight[weight_index];
+                                        facc += word_float(in[input_index]) * word_float(weight[weight_index]);
+                                    }
+                                }
+                            }
+
+                            // fp32 outputs are (acc + bias) * scale
+                            if (data_fp32) {
+                                if (post)
+                                    facc = (facc + word_float(in[post_base + m*3])) * word_float(in[post_base + m*3 + 1]);
+                                if (relu && facc < 0)
+                                    facc = 0;
+
+                                if (pool_avg)
+                                    fresult += facc;
+                                else if ((a == 0 && b == 0) || facc > fresult)
+                                    fresult = facc;
+                                continue;
+                            }
+
+                            // Qm.n products carry 2n fraction bits, rounded back to n
+                            if (frac_bits > 0)
+                                acc = (acc + ((int64_t) 1 << (frac_bits - 1))) >> frac_bits;
+
+                            // Fused bias, requantization and ReLU
+                            if (post) {
+                                acc = (acc + in[post_base + m*3]) * in[post_base + m*3 + 1];
+                                int shift = in[post_base + m*3 + 2];
+                                if (shift > 0)
+                                    acc = (acc + ((int64_t) 1 << (shift - 1))) >> shift;
+                                if (acc > data_max)
+                                    acc = data_max;
+                                else if (acc < -data_max - 1)
+                                    acc = -data_max - 1;
+                            } else if (acc > data_max || acc < -data_max - 1) {
+                                // Raw outputs saturate to DATA_WIDTH bits on their writeback into plm_out
+                                acc = (acc > 0) ? data_max : -data_max - 1;
+                                gold_overflow = true;
+                            }
+                            if (relu && acc < 0)
+                                acc = 0;
+
+                            if (pool_avg)
+                                result += acc;
+                            else if ((a == 0 && b == 0) || acc > result)
+                                result = acc;
                         }
                     }
+                    if (pool_avg) {
+                        result = result / (pool * pool);
+                        fresult = fresult / (pool * pool);
+                    }
+
+                    // Outputs are stored DATA_WIDTH bits wide
+                    if (data_fp32)
+                        gold[gold_index] = float_word(fresult);
+                    else
+                        gold[gold_index] = sc_dt::sc_int<DATA_WIDTH>(result).to_int64();
                 }
             }
         }
     }
+
+    delete [] weight;
     
                             
                 
@@ -199,57 +455,61 @@ void system_t::dump_memory()
 #endif
 
 
-    sc_dt::sc_bv<DATA_WIDTH> data_bv;
-    data_bv = mem[(in_size+out_size)/2 + 0];
-    uint64_t counter = data_bv.to_int64();
+    // The counters follow the output, one per beat
+    uint32_t counters = (in_size + out_size) / DMA_WORD_PER_BEAT;
+    uint64_t counter = mem[counters + 0].range(31, 0).to_uint64();
     cout << "Hardware clock cycle counter: " << counter << endl;
-    
-    data_bv = mem[(in_size+out_size)/2 + 1];
-    uint64_t overflow = data_bv.to_int64();
+
+    uint64_t overflow = mem[counters + 1].range(31, 0).to_uint64();
     cout << "Hardware clock cycle overflow: " << overflow << endl;
-    
 
     int weight_load_total_time = 0;
     int result_write_total_time = 0;
     int kernel_compute_total_time = 0;
     printf("-------Weight Load time-------\n");
     for(int m = 0 ; m < M ; m++){
-        int data_offset = (in_size + out_size + 4 + m*2)/2;
-        sc_dt::sc_bv<64> data;
-        data.range(31, 0) = mem[data_offset + 0];
-        data.range(63, 32) = mem[data_offset + 1];
-
-        int64_t t = data.to_int64();
+        int t = mem[counters + 2 + m].range(31, 0).to_int64();
         printf("Weight Load[%d]: %d\n", m, t);
         weight_load_total_time += t;
     }
     printf("Total weight load time: %d\n", weight_load_total_time);
 
+    // The filters of a pass each get its whole compute time
     printf("-------Kernel Compute time-------\n");
     for(int m = 0 ; m < M ; m++){
-        int data_offset = (in_size + out_size + 4 + M*2 + m*2)/2;
-        sc_dt::sc_bv<64> data;
-        data.range(31, 0) = mem[data_offset + 0];
-        data.range(63, 32) = mem[data_offset + 1];
-
-        int64_t t = data.to_int64();
+        int t = mem[counters + 2 + M + m].range(31, 0).to_int64();
         printf("Kernel Compute[%d]: %d\n", m, t);
         kernel_compute_total_time += t;
     }
     printf("Total kernel compute time: %d\n", kernel_compute_total_time);
 
     printf("-------Result Write time-------\n");
-    for(int m = 0 ; m < M ; m++){        
-        int data_offset = (in_size + out_size + 4 + M*2*2 + m*2)/2;
-        sc_dt::sc_bv<64> data;
-        data.range(31, 0) = mem[data_offset + 0];
-        data.range(63, 32) = mem[data_offset + 1];
-
-        int64_t t = data.to_int64();
+    for(int m = 0 ; m < M ; m++){
+        int t = mem[counters + 2 + 2*M + m].range(31, 0).to_int64();
         printf("Result Write[%d]: %d\n", m, t);
         result_write_total_time += t;
     }
     printf("Total result write time: %d\n", result_write_total_time);
+
+    // Cycles compute waited for the weights and input of the passes of each filter
+    int compute_stall_total_time = 0;
+    printf("-------Compute Stall time-------\n");
+    for(int m = 0 ; m < M ; m++){
+        int t = mem[counters + 2 + 3*M + m].range(31, 0).to_int64();
+        printf("Compute Stall[%d]: %d\n", m, t);
+        compute_stall_total_time += t;
+    }
+    printf("Total compute stall time: %d\n", compute_stall_total_time);
+
+    uint32_t status = mem[counters + 2 + 4*M].range(31, 0).to_uint64();
+    acc_overflow = (status & STATUS_OVERFLOW) != 0;
+    no_fit = (status & STATUS_NO_FIT) != 0;
+    mismatch = (status & STATUS_MISMATCH) != 0;
+    cout << "Accumulator overflow: " << acc_overflow << endl;
+    if (no_fit)
+        ESP_REPORT_ERROR("no band of the layer fits the PLM profile");
+    if (mismatch)
+        ESP_REPORT_ERROR("the layer does not match the specialized kernel or pool");
     ESP_REPORT_INFO("dump memory completed");
 }
 
@@ -257,16 +517,30 @@ int system_t::validate()
 {
     // Check for mismatches
     uint32_t errors = 0;
-
-    for (int i = 0; i < 1; i++)
-        for (int j = 0; j < M*P*Q; j++)
-            if (gold[i * out_words_adj + j] != out[i * out_words_adj + j]){
+    int out_h = (P - pool) / pool_stride + 1;
+    int out_w = (Q - pool) / pool_stride + 1;
+
+    for (int i = 0; i < N*M; i++)
+        for (int j = 0; j < out_h*out_w; j++)
+            if (data_fp32) {
+                // The accelerator sums in another order, fp32 results may round differently
+                float g = word_float(gold[i * out_plane + j]);
+                if (fabs(g - word_float(out[i * out_plane + j])) > 1e-4 * (1 + fabs(g)))
+                    errors++;
+            } else if (gold[i * out_plane + j] != out[i * out_plane + j]){
                 errors++;
-                // cout << "[ERROR] " << i * out_words_adj + j << endl;
-                // cout << "   Correct: " << gold[i * out_words_adj + j] << endl;
-                // cout << "   Result : " << out[i * out_words_adj + j] << endl;
+                // cout << "[ERROR] " << i * out_plane + j << endl;
+                // cout << "   Correct: " << gold[i * out_plane + j] << endl;
+                // cout << "   Result : " << out[i * out_plane + j] << endl;
             }
 
+    // The flag is raised by the saturated outputs only
+    if (gold_overflow != acc_overflow)
+        errors++;
+
+    if (no_fit || mismatch)
+        errors++;
+
     delete [] in;
     delete [] out;
     delete [] gold;
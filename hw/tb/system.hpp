@@ -54,6 +54,25 @@ public:
         acc->debug(debug);
 
         /* <<--params-default-->> */
+        W = 0;
+        H = 0;
+        frac_bits = 0;
+        coalesce = 0;
+        block_rows = 0;
+        stream = 0;
+        sparse = 0;
+        winograd = 0;
+        groups = 1;
+        pool_avg = 0;
+        pool_stride = 2;
+        pool = 2;
+        relu = 1;
+        post = 1;
+        pad = 0;
+        dilation = 1;
+        stride = 1;
+        N = 2;
+        K = 2;
         mem_output_addr = 10000;
         mem_input_addr = 10000;
         S = 5;
@@ -62,6 +81,22 @@ public:
         P = 28;
         M = 6;
         C = 3;
+        data_range = 0;
+
+        // The small PLM profile cannot hold a band of 14-wide outputs that
+        // fills whole 256-bit beats of 8-bit data
+#if (PLM_PROFILE == 0)
+        Q = 24;
+        P = 24;
+#endif
+
+        // Specialized accelerators only run their compile-time kernel
+#ifdef CONV_R
+        R = CONV_R;
+#endif
+#ifdef CONV_S
+        S = CONV_S;
+#endif
     }
 
     // Processes
@@ -72,6 +107,9 @@ public:
     // Load internal memory
     void load_memory();
 
+    // Set a layer parameter from a name=value argument
+    bool set_param(const char *arg);
+
     // Dump internal memory
     void dump_memory();
 
@@ -80,6 +118,25 @@ public:
 
     // Accelerator-specific data
     /* <<--params-->> */
+    int32_t W;
+    int32_t H;
+    int32_t frac_bits;
+    int32_t coalesce;
+    int32_t block_rows;
+    int32_t stream;
+    int32_t sparse;
+    int32_t winograd;
+    int32_t groups;
+    int32_t pool_avg;
+    int32_t pool_stride;
+    int32_t pool;
+    int32_t relu;
+    int32_t post;
+    int32_t pad;
+    int32_t dilation;
+    int32_t stride;
+    int32_t N;
+    int32_t K;
     int32_t mem_output_addr;
     int32_t mem_input_addr;
     int32_t S;
@@ -89,13 +146,21 @@ public:
     int32_t M;
     int32_t C;
 
+    // Range of the random data, 0 for the default
+    int32_t data_range;
+
     uint32_t in_words_adj;
     uint32_t out_words_adj;
+    uint32_t out_plane;
     uint32_t in_size;
     uint32_t out_size;
     int32_t *in;
     int32_t *out;
     int32_t *gold;
+    bool gold_overflow;
+    bool acc_overflow;
+    bool no_fit;
+    bool mismatch;
 
     // Other Functions
 };
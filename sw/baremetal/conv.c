@@ -10,18 +10,50 @@
 #include <esp_probe.h>
 #include <fixed_point.h>
 
+#ifndef DATA_WIDTH
+#define DATA_WIDTH 32
+#endif
+
+#if (DATA_WIDTH == 8)
+typedef int8_t token_t;
+#elif (DATA_WIDTH == 16)
+typedef int16_t token_t;
+#else
 typedef int32_t token_t;
+#endif
 
-static unsigned DMA_WORD_PER_BEAT(unsigned _st)
-{
-        return (sizeof(void *) / _st);
-}
+/* DMA_WIDTH of the accelerator: every NoC beat of 32 to 256 bits holds
+   BEAT_WORDS tokens */
+#ifndef DMA_WIDTH
+#define DMA_WIDTH 64
+#endif
+
+#define BEAT_WORDS (DMA_WIDTH / DATA_WIDTH)
 
 
 #define SLD_CONV 0x098
 #define DEV_NAME "sld,conv_stratus"
 
 /* <<--params-->> */
+const int32_t W = 0;
+const int32_t H = 0;
+const int32_t frac_bits = 0;
+const int32_t coalesce = 0;
+const int32_t block_rows = 0;
+const int32_t stream = 0;
+const int32_t sparse = 0;
+const int32_t winograd = 0;
+const int32_t groups = 1;
+const int32_t pool_avg = 0;
+const int32_t pool_stride = 2;
+const int32_t pool = 2;
+const int32_t relu = 1;
+const int32_t post = 1;
+const int32_t pad = 0;
+const int32_t dilation = 1;
+const int32_t stride = 1;
+const int32_t N = 2;
+const int32_t K = 2;
 const int32_t mem_output_addr = 10000;
 const int32_t mem_input_addr = 10000;
 const int32_t S = 5;
@@ -31,6 +63,27 @@ const int32_t P = 28;
 const int32_t M = 6;
 const int32_t C = 3;
 
+/* Input height and width in memory: H and W, or when 0 the rows and
+   columns read by the P x Q outputs without the pad */
+#define IN_H (H ? H : (P - 1) * stride + (R - 1) * dilation + 1 - 2 * pad)
+#define IN_W (W ? W : (Q - 1) * stride + (S - 1) * dilation + 1 - 2 * pad)
+
+/* Output height and width after pooling */
+#define OUT_H ((P - pool) / pool_stride + 1)
+#define OUT_W ((Q - pool) / pool_stride + 1)
+
+/* 3x3 stride-1 layers run on the Winograd engine if asked, with 4x4 transformed kernels.
+   Sparse kernels take a nonzero count and room for R x S (tap, value) entries. */
+#define WINOGRAD (winograd && !sparse && R == 3 && S == 3 && stride == 1 && dilation == 1)
+#define TAPS (sparse ? 1 + 2 * R * S : WINOGRAD ? 16 : R * S)
+
+/* Aligned layout: input rows, filters, the post-processing parameters and
+   output planes start on a DMA beat */
+#define BEAT_ALIGN(x) round_up(x, BEAT_WORDS)
+#define IN_ROW BEAT_ALIGN(IN_W)
+#define FILTER_WORDS (sparse ? BEAT_ALIGN(C / groups) + BEAT_ALIGN((C / groups) * R * S * 2) : BEAT_ALIGN((C / groups) * TAPS))
+#define OUT_PLANE BEAT_ALIGN(OUT_H * OUT_W)
+
 static unsigned in_words_adj;
 static unsigned out_words_adj;
 static unsigned in_len;
@@ -40,6 +93,25 @@ static unsigned out_size;
 static unsigned out_offset;
 static unsigned mem_size;
 
+/* Counters and status follow the output, one per DMA beat: the cycle
+   counter and its overflow, then M weight load, compute, write and
+   compute stall times, then the status word. The filters of a
+   pass each get its whole compute and stall time, as they share it. */
+#define COUNTERS (3 + 4 * M)
+
+/* Status word: a raw output saturated, no band of the layer fits the PLM
+   profile, the layer does not match the kernel of a specialized
+   accelerator (nothing was computed in the last two cases) */
+#define CONV_STATUS_OVERFLOW 0x1
+#define CONV_STATUS_NO_FIT 0x2
+#define CONV_STATUS_MISMATCH 0x4
+
+static int read_counter(token_t *buf, int k)
+{
+	return *(int32_t *) &buf[in_len + out_len + k * BEAT_WORDS];
+}
+
+
 /* Size of the contiguous chunks for scatter/gather */
 #define CHUNK_SHIFT 20
 #define CHUNK_SIZE BIT(CHUNK_SHIFT)
@@ -49,6 +121,25 @@ static unsigned mem_size;
 
 /* User defined registers */
 /* <<--regs-->> */
+#define CONV_W_REG 0xa8
+#define CONV_H_REG 0xa4
+#define CONV_FRAC_BITS_REG 0xa0
+#define CONV_COALESCE_REG 0x9c
+#define CONV_BLOCK_ROWS_REG 0x98
+#define CONV_STREAM_REG 0x94
+#define CONV_SPARSE_REG 0x90
+#define CONV_WINOGRAD_REG 0x8c
+#define CONV_GROUPS_REG 0x88
+#define CONV_POOL_AVG_REG 0x84
+#define CONV_POOL_STRIDE_REG 0x80
+#define CONV_POOL_REG 0x7c
+#define CONV_RELU_REG 0x78
+#define CONV_POST_REG 0x74
+#define CONV_PAD_REG 0x70
+#define CONV_DILATION_REG 0x6c
+#define CONV_STRIDE_REG 0x68
+#define CONV_N_REG 0x64
+#define CONV_K_REG 0x60
 #define CONV_MEM_OUTPUT_ADDR_REG 0x5c
 #define CONV_MEM_INPUT_ADDR_REG 0x58
 #define CONV_S_REG 0x54
@@ -65,64 +156,170 @@ static int validate_buf(token_t *out, token_t *gold)
 	int j;
 	unsigned errors = 0;
 
-	for (i = 0; i < 1; i++)
-		for (j = 0; j < M*P*Q; j++)
-			if (gold[i * out_words_adj + j] != out[i * out_words_adj + j]){
+	for (i = 0; i < N*M; i++)
+		for (j = 0; j < OUT_H*OUT_W; j++)
+			if (gold[i * OUT_PLANE + j] != out[i * OUT_PLANE + j]){
 				
 				errors++; 
 			}
 			else {
-				//printf("[Correct] %d: %d\n", i * out_words_adj + j,out[i * out_words_adj + j]);
+				//printf("[Correct] %d: %d\n", i * OUT_PLANE + j,out[i * OUT_PLANE + j]);
 			}
 
 	return errors;
 }
 
 
+/* Weights are tokens, and on the Winograd engine their 4x4 transforms
+   grow them up to 9x and must still be tokens */
+#define WEIGHT_RANGE ((int) ((((int64_t) 1 << (DATA_WIDTH - 1)) - 1) / (WINOGRAD ? 9 : 1)))
+
+/* Weight (c, r, s) of every filter, two thirds of them pruned if sparse */
+static int kernel_weight(int c, int r, int s)
+{
+	if (sparse && (r * S + s) % 3)
+		return 0;
+
+	return (c * R * S + r * S + s) % WEIGHT_RANGE;
+}
+
+
 static void init_buf (token_t *in, token_t * gold)
 {
     int num = 0;
     int index = 0;
-    int weight_base = C * (P + R - 1) * (Q + S - 1);
     // input
-    for (int c = 0 ; c < C ; c++){
-        for(int j = 0 ; j < (P + R - 1) ; j++){
-            for(int k = 0 ; k < (Q + S - 1) ; k++){
-                //in[index++] = (token_t)(rand()%1000-500); // range from -50 ~ 49
-                in[index++] = (token_t)num++; // range from -50 ~ 49
+    for (int n = 0 ; n < N ; n++){
+        for (int c = 0 ; c < C ; c++){
+            for(int j = 0 ; j < IN_H ; j++){
+                for(int k = 0 ; k < IN_W ; k++){
+                    //in[index++] = (token_t)(rand()%1000-500); // range from -50 ~ 49
+                    in[(n*C + c)*IN_H*IN_ROW + j*IN_ROW + k] = (token_t)num++; // range from -50 ~ 49
+                }
             }
         }
     }
     
     // weight
-    
-    for (int m = 0 ; m < M ; m++){
-        num = 0;
-        for (int c = 0 ; c < C ; c++){
+    // The Winograd engine reads the 4x4 transformed kernels (2G) g (2G)^T
+    const int G[4][3] = {{2, 0, 0}, {1, 1, 1}, {1, -1, 1}, {0, 0, 2}};
+
+    // Sparse kernels: a filter holds the nonzero counts of its channels,
+    // then their (tap, value) entries
+    int weight_base = N*C*IN_H*IN_ROW;
+    if (sparse) {
+        for (int m = 0 ; m < M ; m++){
+            index = weight_base + m * FILTER_WORDS;
+            int entry = index + BEAT_ALIGN(C / groups);
+            for (int c = 0 ; c < C / groups ; c++){
+                int nnz = 0;
+                for (int t = 0 ; t < R * S ; t++){
+                    if (kernel_weight(c, t / S, t % S) != 0) {
+                        in[entry++] = (token_t) t;
+                        in[entry++] = (token_t) kernel_weight(c, t / S, t % S);
+                        nnz++;
+                    }
+                }
+                in[index++] = (token_t) nnz;
+            }
+        }
+    }
+
+    for (int m = 0 ; m < M && !sparse ; m++){
+        index = weight_base + m * FILTER_WORDS;
+        for (int c = 0 ; c < C / groups ; c++){
+            if (WINOGRAD) {
+                for (int i = 0 ; i < 4 ; i++){
+                    for (int j = 0 ; j < 4 ; j++){
+                        int u = 0;
+                        for (int r = 0 ; r < 3 ; r++)
+                            for (int s = 0 ; s < 3 ; s++)
+                                u += G[i][r] * kernel_weight(c, r, s) * G[j][s];
+                        in[index++] = (token_t) u;
+                    }
+                }
+                continue;
+            }
             for (int r = 0 ; r < R ; r++){
                 for (int s = 0 ; s < S ; s++){
-                    //in[index++] = (token_t)(rand()%1000-500); // range from -500 ~ 499
-                	in[index++] = (token_t)num++; // range from -50 ~ 49
-                    //printf("in[%d]:%d\n", index, in[index-1]);
+                    in[index++] = (token_t) kernel_weight(c, r, s);
                 }
             }
         }
     }
 
 
-    for (int m = 0 ; m < M ; m++){
-        for (int p = 0 ; p < P ; p++){
-            for (int q = 0 ; q < Q ; q++){
-                int gold_index = m*P*Q + p*Q +q;
-                gold[gold_index] = 0;
-                for (int c = 0 ; c < C ; c++){
-                    for (int r = 0 ; r < R ; r++){
-                        for (int s = 0 ; s < S ; s++){
-                            int input_index = c*(P+R-1)*(Q+S-1) + (p+r)*(Q+S-1) + (q+s);
-                            int weight_index = weight_base + m*C*R*S + c*R*S + r*S + s;
-                            gold[gold_index] += in[input_index] * in[weight_index];
+    // bias, multiplier and shift of each filter
+    const int64_t data_max = ((int64_t) 1 << (DATA_WIDTH - 1)) - 1;
+    int post_base = weight_base + M * FILTER_WORDS;
+    index = post_base;
+    if (post) {
+        for (int m = 0 ; m < M ; m++){
+            in[index++] = (token_t)(m * 7 - 20);
+            in[index++] = (token_t)(m % 4 + 1);
+            in[index++] = (token_t)(m % 6);
+        }
+    }
+
+    for (int n = 0 ; n < N ; n++){
+        for (int m = 0 ; m < M ; m++){
+            for (int pp = 0 ; pp < OUT_H ; pp++){
+                for (int qq = 0 ; qq < OUT_W ; qq++){
+                    int gold_index = n*out_words_adj + m*OUT_PLANE + pp*OUT_W + qq;
+                    int64_t result = 0;
+
+                    // Pooling window of conv outputs (p, q)
+                    for (int a = 0 ; a < pool ; a++){
+                        for (int b = 0 ; b < pool ; b++){
+                            int p = pp*pool_stride + a;
+                            int q = qq*pool_stride + b;
+                            int64_t acc = 0;
+                            for (int c = 0 ; c < C / groups ; c++){
+                                for (int r = 0 ; r < R ; r++){
+                                    for (int s = 0 ; s < S ; s++){
+                                        int y = p*stride + r*dilation - pad;
+                                        int x = q*stride + s*dilation - pad;
+                                        // Taps on the pad read zeros
+                                        if (y < 0 || y >= IN_H || x < 0 || x >= IN_W)
+                                            continue;
+                                        int input_index = (n*C + m/(M/groups)*(C/groups) + c)*IN_H*IN_ROW + y*IN_ROW + x;
+                                        acc += in[input_index] * kernel_weight(c, r, s);
+                                    }
+                                }
+                            }
+
+                            // Qm.n products carry 2n fraction bits, rounded back to n
+                            if (frac_bits > 0)
+                                acc = (acc + ((int64_t) 1 << (frac_bits - 1))) >> frac_bits;
+
+                            // Fused bias, requantization and ReLU
+                            if (post) {
+                                acc = (acc + in[post_base + m*3]) * in[post_base + m*3 + 1];
+                                int shift = in[post_base + m*3 + 2];
+                                if (shift > 0)
+                                    acc = (acc + ((int64_t) 1 << (shift - 1))) >> shift;
+                                if (acc > data_max)
+                                    acc = data_max;
+                                else if (acc < -data_max - 1)
+                                    acc = -data_max - 1;
+                            } else if (acc > data_max || acc < -data_max - 1) {
+                                // Raw outputs saturate to DATA_WIDTH bits
+                                acc = (acc > 0) ? data_max : -data_max - 1;
+                            }
+                            if (relu && acc < 0)
+                                acc = 0;
+
+                            if (pool_avg)
+                                result += acc;
+                            else if ((a == 0 && b == 0) || acc > result)
+                                result = acc;
                         }
                     }
+                    if (pool_avg)
+                        result = result / (pool * pool);
+
+                    // Outputs are stored DATA_WIDTH bits wide
+                    gold[gold_index] = (token_t) result;
                 }
             }
         }
@@ -144,19 +341,14 @@ int main(int argc, char * argv[])
 	unsigned errors = 0;
 	unsigned coherence;
 
-	if (DMA_WORD_PER_BEAT(sizeof(token_t)) == 0) {
-		in_words_adj = C*(P+R-1)*(Q+S-1)+M*C*R*S;
-		out_words_adj = M*P*Q;
-	} else {
-		in_words_adj = round_up(C*(P+R-1)*(Q+S-1)+M*C*R*S, DMA_WORD_PER_BEAT(sizeof(token_t)));
-		out_words_adj = round_up(M*P*Q, DMA_WORD_PER_BEAT(sizeof(token_t)));
-	}
+	in_words_adj = N*C*IN_H*IN_ROW+M*FILTER_WORDS+(post ? BEAT_ALIGN(3*M) : 0);
+	out_words_adj = M*OUT_PLANE;
 	in_len = in_words_adj * (1);
-	out_len = out_words_adj * (1);
+	out_len = out_words_adj * (N);
 	in_size = in_len * sizeof(token_t);
 	out_size = out_len * sizeof(token_t);
 	out_offset  = in_len;
-	mem_size = (out_offset * sizeof(token_t)) + out_size + 100* sizeof(token_t);
+	mem_size = (out_offset * sizeof(token_t)) + out_size + COUNTERS * (DMA_WIDTH / 8);
 
 
 	// Search for the device
@@ -228,6 +420,25 @@ int main(int argc, char * argv[])
 
 			// Pass accelerator-specific configuration parameters
 			/* <<--regs-config-->> */
+		iowrite32(dev, CONV_W_REG, W);
+		iowrite32(dev, CONV_H_REG, H);
+		iowrite32(dev, CONV_FRAC_BITS_REG, frac_bits);
+		iowrite32(dev, CONV_COALESCE_REG, coalesce);
+		iowrite32(dev, CONV_BLOCK_ROWS_REG, block_rows);
+		iowrite32(dev, CONV_STREAM_REG, stream);
+		iowrite32(dev, CONV_SPARSE_REG, sparse);
+		iowrite32(dev, CONV_WINOGRAD_REG, winograd);
+		iowrite32(dev, CONV_GROUPS_REG, groups);
+		iowrite32(dev, CONV_POOL_AVG_REG, pool_avg);
+		iowrite32(dev, CONV_POOL_STRIDE_REG, pool_stride);
+		iowrite32(dev, CONV_POOL_REG, pool);
+		iowrite32(dev, CONV_RELU_REG, relu);
+		iowrite32(dev, CONV_POST_REG, post);
+		iowrite32(dev, CONV_PAD_REG, pad);
+		iowrite32(dev, CONV_DILATION_REG, dilation);
+		iowrite32(dev, CONV_STRIDE_REG, stride);
+		iowrite32(dev, CONV_N_REG, N);
+		iowrite32(dev, CONV_K_REG, K);
 		iowrite32(dev, CONV_MEM_OUTPUT_ADDR_REG, mem_output_addr);
 		iowrite32(dev, CONV_MEM_INPUT_ADDR_REG, mem_input_addr);
 		iowrite32(dev, CONV_S_REG, S);
@@ -257,6 +468,14 @@ int main(int argc, char * argv[])
 
 			/* Validation */
 			errors = validate_buf(&mem[out_offset], gold);
+			if (read_counter(mem, 2 + 4*M) & CONV_STATUS_NO_FIT) {
+				printf("  layer does not fit the PLM profile\n");
+				errors++;
+			}
+			if (read_counter(mem, 2 + 4*M) & CONV_STATUS_MISMATCH) {
+				printf("  layer does not match the specialized kernel\n");
+				errors++;
+			}
 			if (errors)
 				printf("  ... FAIL\n");
 			else
@@ -266,16 +485,16 @@ int main(int argc, char * argv[])
 		
 		
 	
-	printf("Hardware clock cycle counter : %d\n", mem[in_len+out_len + 0]);
-	printf("Hardware clock cycle overflow: %d\n", mem[in_len+out_len + 2]);
-	
+	printf("Hardware clock cycle counter : %d\n", read_counter(mem, 0));
+	printf("Hardware clock cycle overflow: %d\n", read_counter(mem, 1));
+
     int weight_load_total_time = 0;
     int result_write_total_time = 0;
     int kernel_compute_total_time = 0;
+    int compute_stall_total_time = 0;
     printf("-------Weight Load time-------\n");
     for(int m = 0 ; m < M ; m++){
-        int data_offset = in_len + out_len + 4 + m*2;
-		int t = mem[data_offset];
+		int t = read_counter(mem, 2 + m);
         printf("Weight Load[%d]: %d\n", m, t);
         weight_load_total_time += t;
     }
@@ -283,23 +502,31 @@ int main(int argc, char * argv[])
 
     printf("-------Kernel Compute time-------\n");
     for(int m = 0 ; m < M ; m++){
-        int data_offset = in_len + out_len + 4 + 2*M + m*2;
-		int t = mem[data_offset];
+		int t = read_counter(mem, 2 + M + m);
         printf("Kernel Compute[%d]: %d\n", m, t);
         kernel_compute_total_time += t;
     }
     printf("Total kernel compute time: %d\n", kernel_compute_total_time);
 
     printf("-------Result Write time-------\n");
-    for(int m = 0 ; m < M ; m++){        
-        int data_offset = in_len + out_len + 4 + 2*2*M + m*2;
-		int t = mem[data_offset];
+    for(int m = 0 ; m < M ; m++){
+		int t = read_counter(mem, 2 + 2*M + m);
         printf("Result Write[%d]: %d\n", m, t);
         result_write_total_time += t;
     }
     printf("Total result write time: %d\n", result_write_total_time);
-		
-    
+
+    printf("-------Compute Stall time-------\n");
+    for(int m = 0 ; m < M ; m++){
+		int t = read_counter(mem, 2 + 3*M + m);
+        printf("Compute Stall[%d]: %d\n", m, t);
+        compute_stall_total_time += t;
+    }
+    printf("Total compute stall time: %d\n", compute_stall_total_time);
+
+	/* Raw outputs that exceeded DATA_WIDTH bits, saturated on their writeback */
+	printf("Accumulator overflow: %d\n", (read_counter(mem, 2 + 4*M) & CONV_STATUS_OVERFLOW) != 0);
+
 		aligned_free(ptable);
 		aligned_free(mem);
 		aligned_free(gold);
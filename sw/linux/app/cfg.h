@@ -6,9 +6,46 @@
 #include "libesp.h"
 #include "conv_stratus.h"
 
+#ifndef DATA_WIDTH
+#define DATA_WIDTH 32
+#endif
+
+#if (DATA_WIDTH == 8)
+typedef int8_t token_t;
+#elif (DATA_WIDTH == 16)
+typedef int16_t token_t;
+#else
 typedef int32_t token_t;
+#endif
+
+/* DMA_WIDTH of the accelerator: every NoC beat of 32 to 256 bits holds
+   BEAT_WORDS tokens */
+#ifndef DMA_WIDTH
+#define DMA_WIDTH 64
+#endif
+
+#define BEAT_WORDS (DMA_WIDTH / DATA_WIDTH)
 
 /* <<--params-def-->> */
+#define _W 0
+#define _H 0
+#define _FRAC_BITS 0
+#define _COALESCE 0
+#define _BLOCK_ROWS 0
+#define _STREAM 0
+#define _SPARSE 0
+#define _WINOGRAD 0
+#define _GROUPS 1
+#define _POOL_AVG 0
+#define _POOL_STRIDE 2
+#define _POOL 2
+#define _RELU 1
+#define _POST 1
+#define _PAD 0
+#define _DILATION 1
+#define _STRIDE 1
+#define _N 2
+#define _K 2
 #define _MEM_OUTPUT_ADDR 10000
 #define _MEM_INPUT_ADDR 10000
 #define _S 5
@@ -19,6 +56,25 @@ typedef int32_t token_t;
 #define _C 3
 
 /* <<--params-->> */
+const int32_t W = _W;
+const int32_t H = _H;
+const int32_t frac_bits = _FRAC_BITS;
+const int32_t coalesce = _COALESCE;
+const int32_t block_rows = _BLOCK_ROWS;
+const int32_t stream = _STREAM;
+const int32_t sparse = _SPARSE;
+const int32_t winograd = _WINOGRAD;
+const int32_t groups = _GROUPS;
+const int32_t pool_avg = _POOL_AVG;
+const int32_t pool_stride = _POOL_STRIDE;
+const int32_t pool = _POOL;
+const int32_t relu = _RELU;
+const int32_t post = _POST;
+const int32_t pad = _PAD;
+const int32_t dilation = _DILATION;
+const int32_t stride = _STRIDE;
+const int32_t N = _N;
+const int32_t K = _K;
 const int32_t mem_output_addr = _MEM_OUTPUT_ADDR;
 const int32_t mem_input_addr = _MEM_INPUT_ADDR;
 const int32_t S = _S;
@@ -28,11 +84,51 @@ const int32_t P = _P;
 const int32_t M = _M;
 const int32_t C = _C;
 
+/* Input height and width in memory: H and W, or when 0 the rows and
+   columns read by the P x Q outputs without the pad */
+#define IN_H (H ? H : (P - 1) * stride + (R - 1) * dilation + 1 - 2 * pad)
+#define IN_W (W ? W : (Q - 1) * stride + (S - 1) * dilation + 1 - 2 * pad)
+
+/* Output height and width after pooling */
+#define OUT_H ((P - pool) / pool_stride + 1)
+#define OUT_W ((Q - pool) / pool_stride + 1)
+
+/* 3x3 stride-1 layers run on the Winograd engine if asked, with 4x4 transformed kernels.
+   Sparse kernels take a nonzero count and room for R x S (tap, value) entries. */
+#define WINOGRAD (winograd && !sparse && R == 3 && S == 3 && stride == 1 && dilation == 1)
+#define TAPS (sparse ? 1 + 2 * R * S : WINOGRAD ? 16 : R * S)
+
+/* Aligned layout: input rows, filters, the post-processing parameters and
+   output planes start on a DMA beat */
+#define BEAT_ALIGN(x) round_up(x, BEAT_WORDS)
+#define IN_ROW BEAT_ALIGN(IN_W)
+#define FILTER_WORDS (sparse ? BEAT_ALIGN(C / groups) + BEAT_ALIGN((C / groups) * R * S * 2) : BEAT_ALIGN((C / groups) * TAPS))
+#define OUT_PLANE BEAT_ALIGN(OUT_H * OUT_W)
+
 #define NACC 1
 
 struct conv_stratus_access conv_cfg_000[] = {
 	{
 		/* <<--descriptor-->> */
+		.W = _W,
+		.H = _H,
+		.frac_bits = _FRAC_BITS,
+		.coalesce = _COALESCE,
+		.block_rows = _BLOCK_ROWS,
+		.stream = _STREAM,
+		.sparse = _SPARSE,
+		.winograd = _WINOGRAD,
+		.groups = _GROUPS,
+		.pool_avg = _POOL_AVG,
+		.pool_stride = _POOL_STRIDE,
+		.pool = _POOL,
+		.relu = _RELU,
+		.post = _POST,
+		.pad = _PAD,
+		.dilation = _DILATION,
+		.stride = _STRIDE,
+		.N = _N,
+		.K = _K,
 		.mem_output_addr = _MEM_OUTPUT_ADDR,
 		.mem_input_addr = _MEM_INPUT_ADDR,
 		.S = _S,
@@ -19,12 +19,12 @@ static int validate_buffer(token_t *out, token_t *gold)
 	int j;
 	unsigned errors = 0;
 
-	for (i = 0; i < 1; i++)
-		for (j = 0; j < M*P*Q; j++)
-			if (gold[i * out_words_adj + j] != out[i * out_words_adj + j]){
-				printf("Error[%d]:\n", i * out_words_adj + j);
-				printf("	Correct: %d\n", gold[i * out_words_adj + j]);
-				printf("	Result : %d\n", out[i * out_words_adj + j]);
+	for (i = 0; i < N*M; i++)
+		for (j = 0; j < OUT_H*OUT_W; j++)
+			if (gold[i * OUT_PLANE + j] != out[i * OUT_PLANE + j]){
+				printf("Error[%d]:\n", i * OUT_PLANE + j);
+				printf("	Correct: %d\n", gold[i * OUT_PLANE + j]);
+				printf("	Result : %d\n", out[i * OUT_PLANE + j]);
 				errors++;
 			}
 
@@ -32,52 +32,158 @@ static int validate_buffer(token_t *out, token_t *gold)
 }
 
 
+/* Weights are tokens, and on the Winograd engine their 4x4 transforms
+   grow them up to 9x and must still be tokens */
+#define WEIGHT_RANGE ((int) ((((int64_t) 1 << (DATA_WIDTH - 1)) - 1) / (WINOGRAD ? 9 : 1)))
+
+/* Weight (c, r, s) of every filter, two thirds of them pruned if sparse */
+static int kernel_weight(int c, int r, int s)
+{
+	if (sparse && (r * S + s) % 3)
+		return 0;
+
+	return (c * R * S + r * S + s) % WEIGHT_RANGE;
+}
+
+
 /* User-defined code */
 static void init_buffer(token_t *in, token_t * gold)
 {
    int num = 0;
     int index = 0;
-    int weight_base = C * (P + R - 1) * (Q + S - 1);
     // input
-    for (int c = 0 ; c < C ; c++){
-        for(int j = 0 ; j < (P + R - 1) ; j++){
-            for(int k = 0 ; k < (Q + S - 1) ; k++){
-                //in[index++] = (token_t)(rand()%1000-500); // range from -50 ~ 49
-                in[index++] = (token_t)num++; // range from -50 ~ 49
-                //printf("in[%d]:%d\n", index-1, in[index-1]);
+    for (int n = 0 ; n < N ; n++){
+        for (int c = 0 ; c < C ; c++){
+            for(int j = 0 ; j < IN_H ; j++){
+                for(int k = 0 ; k < IN_W ; k++){
+                    //in[index++] = (token_t)(rand()%1000-500); // range from -50 ~ 49
+                    in[(n*C + c)*IN_H*IN_ROW + j*IN_ROW + k] = (token_t)num++; // range from -50 ~ 49
+                    //printf("in[%d]:%d\n", index-1, in[index-1]);
+                }
             }
         }
     }
     
     // weight
-    
-    for (int m = 0 ; m < M ; m++){
-        num = 0;
-        for (int c = 0 ; c < C ; c++){
+    // The Winograd engine reads the 4x4 transformed kernels (2G) g (2G)^T
+    const int G[4][3] = {{2, 0, 0}, {1, 1, 1}, {1, -1, 1}, {0, 0, 2}};
+
+    // Sparse kernels: a filter holds the nonzero counts of its channels,
+    // then their (tap, value) entries
+    int weight_base = N*C*IN_H*IN_ROW;
+    if (sparse) {
+        for (int m = 0 ; m < M ; m++){
+            index = weight_base + m * FILTER_WORDS;
+            int entry = index + BEAT_ALIGN(C / groups);
+            for (int c = 0 ; c < C / groups ; c++){
+                int nnz = 0;
+                for (int t = 0 ; t < R * S ; t++){
+                    if (kernel_weight(c, t / S, t % S) != 0) {
+                        in[entry++] = (token_t) t;
+                        in[entry++] = (token_t) kernel_weight(c, t / S, t % S);
+                        nnz++;
+                    }
+                }
+                in[index++] = (token_t) nnz;
+            }
+        }
+    }
+
+    for (int m = 0 ; m < M && !sparse ; m++){
+        index = weight_base + m * FILTER_WORDS;
+        for (int c = 0 ; c < C / groups ; c++){
+            if (WINOGRAD) {
+                for (int i = 0 ; i < 4 ; i++){
+                    for (int j = 0 ; j < 4 ; j++){
+                        int u = 0;
+                        for (int r = 0 ; r < 3 ; r++)
+                            for (int s = 0 ; s < 3 ; s++)
+                                u += G[i][r] * kernel_weight(c, r, s) * G[j][s];
+                        in[index++] = (token_t) u;
+                    }
+                }
+                continue;
+            }
             for (int r = 0 ; r < R ; r++){
                 for (int s = 0 ; s < S ; s++){
-                    //in[index++] = (token_t)(rand()%1000-500); // range from -500 ~ 499
-                    in[index++] = (token_t)num++; // range from -500 ~ 499
-                    //printf("in[%d]:%d\n", index-1, in[index-1]);
+                    in[index++] = (token_t) kernel_weight(c, r, s);
                 }
             }
         }
     }
 
 
-    for (int m = 0 ; m < M ; m++){
-        for (int p = 0 ; p < P ; p++){
-            for (int q = 0 ; q < Q ; q++){
-                int gold_index = m*P*Q + p*Q +q;
-                gold[gold_index] = 0;
-                for (int c = 0 ; c < C ; c++){
-                    for (int r = 0 ; r < R ; r++){
-                        for (int s = 0 ; s < S ; s++){
-                            int input_index = c*(P+R-1)*(Q+S-1) + (p+r)*(Q+S-1) + (q+s);
-                            int weight_index = weight_base + m*C*R*S + c*R*S + r*S + s;
-                            gold[gold_index] += in[input_index] * in[weight_index];
+    // bias, multiplier and shift of each filter
+    const int64_t data_max = ((int64_t) 1 << (DATA_WIDTH - 1)) - 1;
+    int post_base = weight_base + M * FILTER_WORDS;
+    index = post_base;
+    if (post) {
+        for (int m = 0 ; m < M ; m++){
+            in[index++] = (token_t)(m * 7 - 20);
+            in[index++] = (token_t)(m % 4 + 1);
+            in[index++] = (token_t)(m % 6);
+        }
+    }
+
+    for (int n = 0 ; n < N ; n++){
+        for (int m = 0 ; m < M ; m++){
+            for (int pp = 0 ; pp < OUT_H ; pp++){
+                for (int qq = 0 ; qq < OUT_W ; qq++){
+                    int gold_index = n*out_words_adj + m*OUT_PLANE + pp*OUT_W + qq;
+                    int64_t result = 0;
+
+                    // Pooling window of conv outputs (p, q)
+                    for (int a = 0 ; a < pool ; a++){
+                        for (int b = 0 ; b < pool ; b++){
+                            int p = pp*pool_stride + a;
+                            int q = qq*pool_stride + b;
+                            int64_t acc = 0;
+                            for (int c = 0 ; c < C / groups ; c++){
+                                for (int r = 0 ; r < R ; r++){
+                                    for (int s = 0 ; s < S ; s++){
+                                        int y = p*stride + r*dilation - pad;
+                                        int x = q*stride + s*dilation - pad;
+                                        // Taps on the pad read zeros
+                                        if (y < 0 || y >= IN_H || x < 0 || x >= IN_W)
+                                            continue;
+                                        int input_index = (n*C + m/(M/groups)*(C/groups) + c)*IN_H*IN_ROW + y*IN_ROW + x;
+                                        acc += in[input_index] * kernel_weight(c, r, s);
+                                    }
+                                }
+                            }
+
+                            // Qm.n products carry 2n fraction bits, rounded back to n
+                            if (frac_bits > 0)
+                                acc = (acc + ((int64_t) 1 << (frac_bits - 1))) >> frac_bits;
+
+                            // Fused bias, requantization and ReLU
+                            if (post) {
+                                acc = (acc + in[post_base + m*3]) * in[post_base + m*3 + 1];
+                                int shift = in[post_base + m*3 + 2];
+                                if (shift > 0)
+                                    acc = (acc + ((int64_t) 1 << (shift - 1))) >> shift;
+                                if (acc > data_max)
+                                    acc = data_max;
+                                else if (acc < -data_max - 1)
+                                    acc = -data_max - 1;
+                            } else if (acc > data_max || acc < -data_max - 1) {
+                                // Raw outputs saturate to DATA_WIDTH bits
+                                acc = (acc > 0) ? data_max : -data_max - 1;
+                            }
+                            if (relu && acc < 0)
+                                acc = 0;
+
+                            if (pool_avg)
+                                result += acc;
+                            else if ((a == 0 && b == 0) || acc > result)
+                                result = acc;
                         }
                     }
+                    if (pool_avg)
+                        result = result / (pool * pool);
+
+                    // Outputs are stored DATA_WIDTH bits wide
+                    gold[gold_index] = (token_t) result;
                 }
             }
         }
@@ -85,28 +191,36 @@ static void init_buffer(token_t *in, token_t * gold)
 }
 
 
+/* Counters and status follow the output, one per DMA beat: the cycle
+   counter and its overflow, then M weight load, compute, write and
+   compute stall times, then the status word. The filters of a
+   pass each get its whole compute and stall time, as they share it. */
+#define COUNTERS (3 + 4 * M)
+
+static int read_counter(token_t *buf, int k)
+{
+	return *(int32_t *) &buf[in_len + out_len + k * BEAT_WORDS];
+}
+
+
 /* User-defined code */
 static void init_parameters()
 {
-	if (DMA_WORD_PER_BEAT(sizeof(token_t)) == 0) {
-		in_words_adj = C*(P+R-1)*(Q+S-1)+M*C*R*S;
-		out_words_adj = M*P*Q;
-	} else {
-		in_words_adj = round_up(C*(P+R-1)*(Q+S-1)+M*C*R*S, DMA_WORD_PER_BEAT(sizeof(token_t)));
-		out_words_adj = round_up(M*P*Q, DMA_WORD_PER_BEAT(sizeof(token_t)));
-	}
+	in_words_adj = N*C*IN_H*IN_ROW+M*FILTER_WORDS+(post ? BEAT_ALIGN(3*M) : 0);
+	out_words_adj = M*OUT_PLANE;
 	in_len = in_words_adj * (1);
-	out_len =  out_words_adj * (1);
+	out_len =  out_words_adj * (N);
 	in_size = in_len * sizeof(token_t);
 	out_size = out_len * sizeof(token_t);
 	out_offset = in_len;
-	size = (out_offset * sizeof(token_t)) + out_size + 100 * sizeof(token_t);
+	size = (out_offset * sizeof(token_t)) + out_size + COUNTERS * (DMA_WIDTH / 8);
 }
 
 
 int main(int argc, char **argv)
 {
 	int errors;
+	int status;
 
 	token_t *gold;
 	token_t *buf;
@@ -122,6 +236,25 @@ int main(int argc, char **argv)
 
 	printf("\n====== %s ======\n\n", cfg_000[0].devname);
 	/* <<--print-params-->> */
+	printf("  .W = %d\n", W);
+	printf("  .H = %d\n", H);
+	printf("  .frac_bits = %d\n", frac_bits);
+	printf("  .coalesce = %d\n", coalesce);
+	printf("  .block_rows = %d\n", block_rows);
+	printf("  .stream = %d\n", stream);
+	printf("  .sparse = %d\n", sparse);
+	printf("  .winograd = %d\n", winograd);
+	printf("  .groups = %d\n", groups);
+	printf("  .pool_avg = %d\n", pool_avg);
+	printf("  .pool_stride = %d\n", pool_stride);
+	printf("  .pool = %d\n", pool);
+	printf("  .relu = %d\n", relu);
+	printf("  .post = %d\n", post);
+	printf("  .pad = %d\n", pad);
+	printf("  .dilation = %d\n", dilation);
+	printf("  .stride = %d\n", stride);
+	printf("  .N = %d\n", N);
+	printf("  .K = %d\n", K);
 	printf("  .mem_output_addr = %d\n", mem_output_addr);
 	printf("  .mem_input_addr = %d\n", mem_input_addr);
 	printf("  .S = %d\n", S);
@@ -136,16 +269,16 @@ int main(int argc, char **argv)
 
 	printf("\n  ** DONE **\n");
 
-	printf("Hardware clock cycle counter : %d\n", buf[in_len+out_len + 0]);
-	printf("Hardware clock cycle overflow: %d\n", buf[in_len+out_len + 1]);
+	printf("Hardware clock cycle counter : %d\n", read_counter(buf, 0));
+	printf("Hardware clock cycle overflow: %d\n", read_counter(buf, 1));
 
     int weight_load_total_time = 0;
     int result_write_total_time = 0;
     int kernel_compute_total_time = 0;
+    int compute_stall_total_time = 0;
     printf("-------Weight Load time-------\n");
     for(int m = 0 ; m < M ; m++){
-        int data_offset = in_len + out_len + 4 + m*2;
-		int t = buf[data_offset];
+		int t = read_counter(buf, 2 + m);
         printf("Weight Load[%d]: %d\n", m, t);
         weight_load_total_time += t;
     }
@@ -153,22 +286,45 @@ int main(int argc, char **argv)
 
     printf("-------Kernel Compute time-------\n");
     for(int m = 0 ; m < M ; m++){
-        int data_offset = in_len + out_len + 4 + 2*M + m*2;
-		int t = buf[data_offset];
+		int t = read_counter(buf, 2 + M + m);
         printf("Kernel Compute[%d]: %d\n", m, t);
         kernel_compute_total_time += t;
     }
     printf("Total kernel compute time: %d\n", kernel_compute_total_time);
 
     printf("-------Result Write time-------\n");
-    for(int m = 0 ; m < M ; m++){        
-        int data_offset = in_len + out_len + 4 + 2*2*M + m*2;
-		int t = buf[data_offset];
+    for(int m = 0 ; m < M ; m++){
+		int t = read_counter(buf, 2 + 2*M + m);
         printf("Result Write[%d]: %d\n", m, t);
         result_write_total_time += t;
     }
+    printf("Total result write time: %d\n", result_write_total_time);
+
+    printf("-------Compute Stall time-------\n");
+    for(int m = 0 ; m < M ; m++){
+		int t = read_counter(buf, 2 + 3*M + m);
+        printf("Compute Stall[%d]: %d\n", m, t);
+        compute_stall_total_time += t;
+    }
+    printf("Total compute stall time: %d\n", compute_stall_total_time);
+
+	/* Raw outputs that exceeded DATA_WIDTH bits, saturated on their writeback */
+	status = read_counter(buf, 2 + 4*M);
+	printf("Accumulator overflow: %d\n", (status & CONV_STATUS_OVERFLOW) != 0);
 	errors = validate_buffer(&buf[out_offset], gold);
 
+	/* Layers that no band of the PLM profile fits are not computed */
+	if (status & CONV_STATUS_NO_FIT) {
+		printf("Layer does not fit the PLM profile\n");
+		errors++;
+	}
+
+	/* Nor are layers that a specialized accelerator has no kernel for */
+	if (status & CONV_STATUS_MISMATCH) {
+		printf("Layer does not match the specialized kernel\n");
+		errors++;
+	}
+
 	free(gold);
 	esp_free(buf);
 
@@ -13,6 +13,25 @@
 #define DRV_NAME	"conv_stratus"
 
 /* <<--regs-->> */
+#define CONV_W_REG 0xa8
+#define CONV_H_REG 0xa4
+#define CONV_FRAC_BITS_REG 0xa0
+#define CONV_COALESCE_REG 0x9c
+#define CONV_BLOCK_ROWS_REG 0x98
+#define CONV_STREAM_REG 0x94
+#define CONV_SPARSE_REG 0x90
+#define CONV_WINOGRAD_REG 0x8c
+#define CONV_GROUPS_REG 0x88
+#define CONV_POOL_AVG_REG 0x84
+#define CONV_POOL_STRIDE_REG 0x80
+#define CONV_POOL_REG 0x7c
+#define CONV_RELU_REG 0x78
+#define CONV_POST_REG 0x74
+#define CONV_PAD_REG 0x70
+#define CONV_DILATION_REG 0x6c
+#define CONV_STRIDE_REG 0x68
+#define CONV_N_REG 0x64
+#define CONV_K_REG 0x60
 #define CONV_MEM_OUTPUT_ADDR_REG 0x5c
 #define CONV_MEM_INPUT_ADDR_REG 0x58
 #define CONV_S_REG 0x54
@@ -53,6 +72,25 @@ static void conv_prep_xfer(struct esp_device *esp, void *arg)
 	struct conv_stratus_access *a = arg;
 
 	/* <<--regs-config-->> */
+	iowrite32be(a->W, esp->iomem + CONV_W_REG);
+	iowrite32be(a->H, esp->iomem + CONV_H_REG);
+	iowrite32be(a->frac_bits, esp->iomem + CONV_FRAC_BITS_REG);
+	iowrite32be(a->coalesce, esp->iomem + CONV_COALESCE_REG);
+	iowrite32be(a->block_rows, esp->iomem + CONV_BLOCK_ROWS_REG);
+	iowrite32be(a->stream, esp->iomem + CONV_STREAM_REG);
+	iowrite32be(a->sparse, esp->iomem + CONV_SPARSE_REG);
+	iowrite32be(a->winograd, esp->iomem + CONV_WINOGRAD_REG);
+	iowrite32be(a->groups, esp->iomem + CONV_GROUPS_REG);
+	iowrite32be(a->pool_avg, esp->iomem + CONV_POOL_AVG_REG);
+	iowrite32be(a->pool_stride, esp->iomem + CONV_POOL_STRIDE_REG);
+	iowrite32be(a->pool, esp->iomem + CONV_POOL_REG);
+	iowrite32be(a->relu, esp->iomem + CONV_RELU_REG);
+	iowrite32be(a->post, esp->iomem + CONV_POST_REG);
+	iowrite32be(a->pad, esp->iomem + CONV_PAD_REG);
+	iowrite32be(a->dilation, esp->iomem + CONV_DILATION_REG);
+	iowrite32be(a->stride, esp->iomem + CONV_STRIDE_REG);
+	iowrite32be(a->N, esp->iomem + CONV_N_REG);
+	iowrite32be(a->K, esp->iomem + CONV_K_REG);
 	iowrite32be(a->mem_output_addr, esp->iomem + CONV_MEM_OUTPUT_ADDR_REG);
 	iowrite32be(a->mem_input_addr, esp->iomem + CONV_MEM_INPUT_ADDR_REG);
 	iowrite32be(a->S, esp->iomem + CONV_S_REG);
@@ -69,7 +107,75 @@ static void conv_prep_xfer(struct esp_device *esp, void *arg)
 static bool conv_xfer_input_ok(struct esp_device *esp, void *arg)
 {
 	/* struct conv_stratus_device *conv = to_conv(esp); */
-	/* struct conv_stratus_access *a = arg; */
+	struct conv_stratus_access *a = arg;
+	unsigned in_width, in_height, pitch, rows, taps;
+
+	if (a->K == 0 || a->K > CONV_FILTERS_MAX)
+		return false;
+
+	/* Zero sizes, strides and windows have no layer, the pool window
+	 * covers conv outputs and the conv groups split the channels and
+	 * filters evenly */
+	if (a->N == 0 || a->P == 0 || a->Q == 0 || a->R == 0 || a->S == 0 ||
+	    a->C == 0 || a->M == 0)
+		return false;
+	if (a->stride == 0 || a->dilation == 0 || a->pool == 0 || a->pool_stride == 0)
+		return false;
+	if (a->pool > a->P || a->pool > a->Q)
+		return false;
+	if (a->groups == 0 || a->C % a->groups || a->M % a->groups)
+		return false;
+
+	/* The per-filter counters after the output hold CONV_COUNTERS_MAX filters */
+	if (a->M > CONV_COUNTERS_MAX)
+		return false;
+
+	/* Average pools divide by shifting: the window side is a power of two */
+	if (a->pool_avg && (a->pool & (a->pool - 1)))
+		return false;
+
+	/* Qm.n words keep at least their sign bit out of the fraction */
+	if (a->frac_bits >= 32)
+		return false;
+
+	/* A specialized accelerator only runs its kernel; build the driver
+	 * with the CONV_R and CONV_S of its HLS configuration, else it reports
+	 * CONV_STATUS_MISMATCH */
+#ifdef CONV_R
+	if (a->R != CONV_R)
+		return false;
+#endif
+#ifdef CONV_S
+	if (a->S != CONV_S)
+		return false;
+#endif
+
+	/* A zero H or W is derived from the input the outputs read less the
+	 * pad, which must leave some input */
+	in_width = (a->Q - 1) * a->stride + (a->S - 1) * a->dilation + 1;
+	in_height = (a->P - 1) * a->stride + (a->R - 1) * a->dilation + 1;
+	if ((a->H == 0 && in_height <= 2 * a->pad) || (a->W == 0 && in_width <= 2 * a->pad))
+		return false;
+
+	/* One filter pass over one channel must fit the PLM profile: the input
+	 * rows of a pooled output row, the weights and post-processing
+	 * parameters of a filter and its pool conv rows. These are necessary
+	 * conditions only; the data width and the beat alignment of the bands
+	 * can still leave no band that fits, which the accelerator reports
+	 * with CONV_STATUS_NO_FIT in the status word of the output. */
+	pitch = in_width + (1 + CONV_PLM_IN_BANKS - in_width % CONV_PLM_IN_BANKS) % CONV_PLM_IN_BANKS;
+	rows = (a->pool - 1) * a->stride + (a->R - 1) * a->dilation + 1;
+	rows = (rows + a->dilation - 1) / a->dilation * a->dilation;
+	taps = a->sparse ? 1 + 2 * a->R * a->S : a->R * a->S;
+	if (a->winograd && !a->sparse && a->R == 3 && a->S == 3 && a->stride == 1 && a->dilation == 1)
+		taps = 16;
+
+	if (rows * pitch > CONV_PLM_IN_SIZE)
+		return false;
+	if (taps + 3 > CONV_PLM_WEIGHT_SIZE)
+		return false;
+	if (a->pool * a->Q > CONV_PLM_OUT_SIZE)
+		return false;
 
 	return true;
 }
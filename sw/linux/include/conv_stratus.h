@@ -17,9 +17,63 @@
 #include <esp.h>
 #include <esp_accelerator.h>
 
+/* Limits of the accelerator PLM profile (PLM_PROFILE of its HLS
+ * configuration): memory sizes in 32-bit words, banks of the input memory,
+ * filters per pass and filters with their own counters */
+#ifndef CONV_PLM_PROFILE
+#define CONV_PLM_PROFILE 1
+#endif
+
+#if (CONV_PLM_PROFILE == 0)
+#define CONV_PLM_IN_SIZE 1600
+#define CONV_PLM_WEIGHT_SIZE 600
+#define CONV_PLM_OUT_SIZE 600
+#define CONV_PLM_IN_BANKS 8
+#elif (CONV_PLM_PROFILE == 2)
+#define CONV_PLM_IN_SIZE 16000
+#define CONV_PLM_WEIGHT_SIZE 4800
+#define CONV_PLM_OUT_SIZE 4800
+#define CONV_PLM_IN_BANKS 8
+#else
+#define CONV_PLM_IN_SIZE 4000
+#define CONV_PLM_WEIGHT_SIZE 1200
+#define CONV_PLM_OUT_SIZE 1200
+#define CONV_PLM_IN_BANKS 8
+#endif
+
+#define CONV_FILTERS_MAX 8
+#define CONV_COUNTERS_MAX 50
+
+/* Status word after the counters in the output buffer: a raw output
+ * saturated, no band of the layer fits the PLM profile, the layer does not
+ * match the kernel of a specialized accelerator or averages a pool whose
+ * side is not a power of two (nothing was computed in the last two cases) */
+#define CONV_STATUS_OVERFLOW 0x1
+#define CONV_STATUS_NO_FIT 0x2
+#define CONV_STATUS_MISMATCH 0x4
+
 struct conv_stratus_access {
 	struct esp_access esp;
 	/* <<--regs-->> */
+	unsigned W;
+	unsigned H;
+	unsigned frac_bits;
+	unsigned coalesce;
+	unsigned block_rows;
+	unsigned stream;
+	unsigned sparse;
+	unsigned winograd;
+	unsigned groups;
+	unsigned pool_avg;
+	unsigned pool_stride;
+	unsigned pool;
+	unsigned relu;
+	unsigned post;
+	unsigned pad;
+	unsigned dilation;
+	unsigned stride;
+	unsigned N;
+	unsigned K;
 	unsigned mem_output_addr;
 	unsigned mem_input_addr;
 	unsigned S;